@@ -0,0 +1,160 @@
+#include "adaptive.h"
+
+#include "bits.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// A leaf of no weight under parent.
+
+static adaptiveNode newLeaf(int16_t parent, int16_t symbol) {
+    return (adaptiveNode) {
+        .weight = 0, .parent = parent, .left = -1, .right = -1, .symbol = symbol,
+    };
+}
+
+// At first the tree is just the NYT leaf, as the root.
+
+adaptive *newAdaptive(void) {
+    adaptive *a = (adaptive *) calloc(1, sizeof(adaptive));
+    if (a) {
+        for (uint32_t s = 0; s < SYMBOLS; s += 1) {
+            a->leaf[s] = -1;
+        }
+        a->n[ROOT] = newLeaf(-1, -1);
+        a->nyt = ROOT;
+        a->at = ROOT;
+    }
+    return a;
+}
+
+void delAdaptive(adaptive *a) {
+    free(a);
+    return;
+}
+
+// Point whatever hangs from node i back at it.
+
+static void adopt(adaptive *a, int16_t i) {
+    adaptiveNode *x = &a->n[i];
+    if (x->left >= 0) {
+        a->n[x->left].parent = i;
+        a->n[x->right].parent = i;
+    } else if (x->symbol >= 0) {
+        a->leaf[x->symbol] = i;
+    } else {
+        a->nyt = i;
+    }
+    return;
+}
+
+// Swap the subtrees at i and j. The parents belong to the places in the
+// order, so they stay where they are.
+
+static void swapNodes(adaptive *a, int16_t i, int16_t j) {
+    adaptiveNode t = a->n[i];
+    int16_t pi = a->n[i].parent, pj = a->n[j].parent;
+    a->n[i] = a->n[j];
+    a->n[j] = t;
+    a->n[i].parent = pi;
+    a->n[j].parent = pj;
+    adopt(a, i);
+    adopt(a, j);
+    return;
+}
+
+// The last node in the order with the same weight as node i.
+
+static int16_t leader(adaptive *a, int16_t i) {
+    int16_t l = i;
+    while (l < ROOT && a->n[l + 1].weight == a->n[i].weight) {
+        l += 1;
+    }
+    return l;
+}
+
+// Count one more s. A new symbol first splits the NYT leaf into a new NYT
+// and a leaf for s. Then, from the leaf of s up to the root, each node is
+// swapped with the leader of its weight (unless that is its parent, which
+// only happens when its sibling is NYT) before its weight goes up by one.
+
+static void update(adaptive *a, uint16_t s) {
+    int16_t q = a->leaf[s];
+    if (q < 0) {
+        int16_t p = a->nyt;
+        a->n[p].left = p - 2;
+        a->n[p].right = p - 1;
+        a->n[p - 1] = newLeaf(p, s);
+        a->n[p - 2] = newLeaf(p, -1);
+        a->leaf[s] = p - 1;
+        a->nyt = p - 2;
+        q = p - 1;
+    }
+    while (q >= 0) {
+        int16_t l = leader(a, q);
+        if (l != q && l != a->n[q].parent) {
+            swapNodes(a, q, l);
+            q = l;
+        }
+        a->n[q].weight += 1;
+        q = a->n[q].parent;
+    }
+    return;
+}
+
+// The code of node i is the path to it from the root: 0 for left, 1 for
+// right. It is found from the node up, so it is sent in reverse.
+
+static void putPath(adaptive *a, bitWriter *w, int16_t i) {
+    uint8_t path[NODES];
+    uint32_t depth = 0;
+    for (; i != ROOT; i = a->n[i].parent) {
+        path[depth] = a->n[a->n[i].parent].right == i;
+        depth += 1;
+    }
+    while (depth > 0) {
+        depth -= 1;
+        putBits(w, path[depth], 1);
+    }
+    return;
+}
+
+void adaptiveEncode(adaptive *a, bitWriter *w, uint16_t s) {
+    if (a->leaf[s] >= 0) {
+        putPath(a, w, a->leaf[s]);
+    } else {
+        putPath(a, w, a->nyt);
+        putBits(w, s, LITERAL);
+    }
+    update(a, s);
+    return;
+}
+
+// The decoder walks down from the root one bit at a time. Once it reaches
+// NYT (at once, while NYT is the root) the bits that follow are a literal.
+
+int32_t adaptiveDecode(adaptive *a, uint32_t bit) {
+    uint16_t s;
+    if (a->at != a->nyt) {
+        a->at = bit ? a->n[a->at].right : a->n[a->at].left;
+        if (a->at == a->nyt || a->n[a->at].left >= 0) {
+            return -1;
+        }
+        s = a->n[a->at].symbol;
+    } else {
+        a->literal |= bit << a->got;
+        a->got += 1;
+        if (a->got < LITERAL) {
+            return -1;
+        }
+        s = a->literal;
+        a->literal = 0;
+        a->got = 0;
+        if (s >= SYMBOLS || a->leaf[s] >= 0) {
+            return -2;
+        }
+    }
+    update(a, s);
+    a->at = ROOT;
+    return s;
+}
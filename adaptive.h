@@ -0,0 +1,55 @@
+#pragma once
+
+#include "bits.h"
+#include "sizes.h"
+
+#include <stdint.h>
+
+// Adaptive Huffman coding (the FGK algorithm): encoder and decoder start
+// with the same empty tree and update it in the same way after every symbol,
+// so no tree is ever sent and the first bits go out as soon as the first
+// byte comes in. A symbol that has not been seen before is sent as the code
+// of the NYT (not yet transmitted) leaf followed by the symbol itself in
+// LITERAL bits. The symbol END, which is never a byte, marks the end.
+//
+// The nodes are kept in an array in their FGK order, weights never
+// decreasing from one to the next, with siblings next to each other and the
+// root last. The update finds the node to swap with among the neighbours of
+// a node in that order, and walks up from a leaf to the root, so the nodes
+// carry their parent and their place in the array rather than being
+// treeNodes joined with pointers.
+
+#define END      BYTE
+#define SYMBOLS  (BYTE + 1)
+#define NODES    (2 * SYMBOLS + 1) // Leaves for every symbol and NYT
+#define LITERAL  9 // Bits in a new symbol, enough for END
+#define ROOT     (NODES - 1)
+
+typedef struct adaptiveNode {
+    uint64_t weight;
+    int16_t parent; // -1 for the root
+    int16_t left, right; // -1 for a leaf
+    int16_t symbol; // For a leaf, -1 for NYT
+} adaptiveNode;
+
+typedef struct adaptive {
+    adaptiveNode n[NODES];
+    int16_t leaf[SYMBOLS]; // The leaf of each symbol, -1 if not yet seen
+    int16_t nyt; // The NYT leaf
+    int16_t at; // Decoder: where the walk from the root has got to
+    uint16_t literal, got; // Decoder: bits of a new symbol so far
+} adaptive;
+
+extern adaptive *newAdaptive(void);
+
+extern void delAdaptive(adaptive *a);
+
+// Append the code for s and update the tree.
+
+extern void adaptiveEncode(adaptive *a, bitWriter *w, uint16_t s);
+
+// Take the next bit of the input, returning the symbol that it completes
+// (after updating the tree), -1 if it does not complete one, or -2 if the
+// input makes no sense.
+
+extern int32_t adaptiveDecode(adaptive *a, uint32_t bit);
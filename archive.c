@@ -0,0 +1,138 @@
+#include "archive.h"
+
+#include "endian.h"
+#include "io.h"
+#include "sizes.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static int byName(const void *a, const void *b) {
+    return strcmp(((const member *) a)->name, ((const member *) b)->name);
+}
+
+static Entry packEntry(const Entry *e) {
+    Entry x = {
+        .offset = isBig() ? swap64(e->offset) : e->offset,
+        .packed = isBig() ? swap64(e->packed) : e->packed,
+        .raw = isBig() ? swap64(e->raw) : e->raw,
+        .permissions = isBig() ? swap16(e->permissions) : e->permissions,
+        .name = isBig() ? swap16(e->name) : e->name,
+        .reserved = 0,
+    };
+    return x;
+}
+
+// The entries go out a buffer at a time, each with its name after it. The
+// buffer always has room for the longest name and the Catalog.
+
+#define SPAN (128 * KB)
+
+bool writeDirectory(int file, uint64_t offset, member *m, uint64_t n) {
+    qsort(m, n, sizeof(member), byName);
+    uint8_t *b = (uint8_t *) malloc(SPAN);
+    if (!b) {
+        return false;
+    }
+    uint64_t start = offset;
+    size_t have = 0;
+    bool ok = true;
+    for (uint64_t i = 0; ok && i < n; i += 1) {
+        if (have + sizeof(Entry) + m[i].e.name + sizeof(Catalog) > SPAN) {
+            ok = writeAt(file, b, have, offset);
+            offset += have;
+            have = 0;
+        }
+        Entry x = packEntry(&m[i].e);
+        memcpy(b + have, &x, sizeof(Entry));
+        memcpy(b + have + sizeof(Entry), m[i].name, m[i].e.name);
+        have += sizeof(Entry) + m[i].e.name;
+    }
+    Catalog c = {
+        .entries = isBig() ? swap64(n) : n,
+        .directory = isBig() ? swap64(start) : start,
+        .reserved = 0,
+        .magic = isBig() ? swap32(CATALOG) : CATALOG,
+    };
+    memcpy(b + have, &c, sizeof(Catalog));
+    have += sizeof(Catalog);
+    ok = ok && writeAt(file, b, have, offset);
+    free(b);
+    return ok;
+}
+
+// The whole directory is read at once. Every member must lie between the
+// Header and the directory, and the names must fill the directory exactly.
+
+directory *readDirectory(int file) {
+    off_t end = lseek(file, 0, SEEK_END);
+    Catalog c;
+    if (end < (off_t) sizeof(Catalog) || !readAt(file, &c, sizeof(Catalog), end - sizeof(Catalog))
+        || (isBig() ? swap32(c.magic) : c.magic) != CATALOG) {
+        return NULL;
+    }
+    uint64_t entries = isBig() ? swap64(c.entries) : c.entries;
+    uint64_t start = isBig() ? swap64(c.directory) : c.directory;
+    uint64_t bytes = end - sizeof(Catalog) - start;
+    if (start > (uint64_t) end - sizeof(Catalog) || entries > bytes / sizeof(Entry)) {
+        return NULL;
+    }
+
+    directory *d = (directory *) calloc(1, sizeof(directory));
+    uint8_t *b = (uint8_t *) malloc(bytes ? bytes : 1);
+    if (!d || !b || !readAt(file, b, bytes, start)) {
+        free(d);
+        free(b);
+        return NULL;
+    }
+    d->count = entries;
+    d->members = (member *) calloc(entries ? entries : 1, sizeof(member));
+    d->names = (char *) malloc(bytes ? bytes : 1); // An Entry has room for the NUL of its name
+    bool ok = d->members && d->names;
+
+    uint64_t p = 0, q = 0;
+    for (uint64_t i = 0; ok && i < entries; i += 1) {
+        Entry x;
+        if (bytes - p < sizeof(Entry)) {
+            ok = false;
+            break;
+        }
+        memcpy(&x, b + p, sizeof(Entry));
+        member *m = &d->members[i];
+        m->e = packEntry(&x);
+        p += sizeof(Entry);
+        ok = m->e.name <= bytes - p && m->e.offset <= start && m->e.packed <= start - m->e.offset;
+        if (ok) {
+            m->name = d->names + q;
+            memcpy(m->name, b + p, m->e.name);
+            m->name[m->e.name] = '\0';
+            ok = strlen(m->name) == m->e.name; // No NUL inside a name
+            p += m->e.name;
+            q += m->e.name + 1;
+        }
+    }
+    free(b);
+    if (!ok || p != bytes) {
+        delDirectory(d);
+        return NULL;
+    }
+    return d;
+}
+
+void delDirectory(directory *d) {
+    if (d) {
+        free(d->members);
+        free(d->names);
+        free(d);
+    }
+    return;
+}
+
+const member *findMember(const directory *d, const char *name) {
+    member key = { .name = (char *) name };
+    return (const member *) bsearch(&key, d->members, d->count, sizeof(member), byName);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// An archive holds many coded files, its members, in one file. It starts
+// with a Header whose magic is ARCHIVE and whose file_size is the number of
+// members. If the members share a saved table, tree_size bytes follow the
+// Header: the ID of the table (two bytes, little endian) and its code
+// lengths (see dumpLengths), which are used in place of the saved table, so
+// the archive needs nothing else to be decoded.
+//
+// Each member is a whole coded file, just as encode writes it: a file of
+// blocks, each block with its own code, or code bits that name the shared
+// table by its ID. After the members comes the directory, an Entry for each
+// member followed by its name, sorted by name. The Catalog at the very end
+// says where the directory is, so that one member can be found and read
+// without looking at any of the others. Like the Header, all of it is little
+// endian.
+
+typedef struct Entry {
+    uint64_t offset; // Where the member starts in the archive
+    uint64_t packed; // Bytes of member
+    uint64_t raw; // Bytes it decodes to
+    uint16_t permissions;
+    uint16_t name; // Bytes of name that follow the Entry
+    uint32_t reserved;
+} Entry;
+
+typedef struct Catalog {
+    uint64_t entries;
+    uint64_t directory; // Where the first Entry is
+    uint32_t reserved;
+    uint32_t magic; // CATALOG
+} Catalog;
+
+#define CATALOG 0xBEEFCA7A
+
+// A member as it is kept in memory, with its name.
+
+typedef struct member {
+    Entry e;
+    char *name;
+} member;
+
+typedef struct directory {
+    uint64_t count;
+    member *members; // Sorted by name
+    char *names; // All of the names, each ending with a NUL
+} directory;
+
+// Sort the n members by name and write them out as the directory at offset,
+// followed by the Catalog.
+
+extern bool writeDirectory(int file, uint64_t offset, member *m, uint64_t n);
+
+// Read the directory from the end of an archive, returning NULL if it has
+// none or it makes no sense.
+
+extern directory *readDirectory(int file);
+
+extern void delDirectory(directory *d);
+
+extern const member *findMember(const directory *d, const char *name);
@@ -0,0 +1,403 @@
+#include "batch.h"
+
+#include "block.h"
+#include "endian.h"
+#include "header.h"
+#include "huffman.h"
+#include "io.h"
+#include "pool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// What the workers share: where the names come from (the next of count names,
+// or standard input if names is NULL), and for an archive where the next
+// member goes and the members so far.
+
+typedef struct batch {
+    const char *program, *suffix;
+    bool add;
+    convert c;
+    expand x;
+    pthread_mutex_t lock; // For the names
+    char **names;
+    uint64_t count, next;
+    int archive; // -1 if there is none
+    pthread_mutex_t writing; // For the archive and its members
+    uint64_t end; // Where the next member goes
+    member *members;
+    uint64_t held, room; // Members, and room for them
+    const member **chosen; // Members to take out of an archive
+} batch;
+
+typedef struct batchJob {
+    job j;
+    batch *b;
+    worker w;
+    char *line; // The last name read from standard input
+    size_t lineSize;
+} batchJob;
+
+// Take the next name, returning NULL once there are no more. Blank lines in a
+// list are skipped.
+
+static const char *nextName(batch *b, batchJob *bj) {
+    const char *name = NULL;
+    pthread_mutex_lock(&b->lock);
+    if (b->names) {
+        name = b->next < b->count ? b->names[b->next++] : NULL;
+    } else {
+        ssize_t n;
+        while (!name && (n = getline(&bj->line, &bj->lineSize, stdin)) >= 0) {
+            if (n > 0 && bj->line[n - 1] == '\n') {
+                bj->line[n - 1] = '\0';
+            }
+            name = bj->line[0] ? bj->line : NULL;
+        }
+    }
+    pthread_mutex_unlock(&b->lock);
+    return name;
+}
+
+// The name of the output of name, or NULL if it has none.
+
+static const char *outputName(batch *b, worker *w, const char *name) {
+    size_t n = strlen(name), s = strlen(b->suffix);
+    if (!b->add && (n <= s || strcmp(name + n - s, b->suffix) != 0)) {
+        return NULL;
+    }
+    size_t need = b->add ? n + s + 1 : n - s + 1;
+    if (need > w->madeSize) {
+        char *t = (char *) realloc(w->made, need);
+        if (!t) {
+            return NULL;
+        }
+        w->made = t;
+        w->madeSize = need;
+    }
+    memcpy(w->made, name, b->add ? n : n - s);
+    if (b->add) {
+        memcpy(w->made + n, b->suffix, s);
+    }
+    w->made[need - 1] = '\0';
+    return w->made;
+}
+
+// A member is only added, or taken out, below the current directory: not at
+// an absolute path, and not through "..".
+
+static bool safeName(const char *name) {
+    if (name[0] == '/' || name[0] == '\0') {
+        return false;
+    }
+    for (const char *p = name; p; p = strchr(p, '/'), p = p ? p + 1 : NULL) {
+        if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Add the coded file that the worker holds to the archive as name. Only the
+// write itself and the bookkeeping are done holding the lock.
+
+static const char *addMember(batch *b, worker *w, const char *name, const struct stat *s) {
+    size_t length = strlen(name);
+    if (!safeName(name)) {
+        return "name is not below the current directory";
+    } else if (length > UINT16_MAX) {
+        return "name too long for an archive";
+    }
+    char *copy = (char *) malloc(length + 1);
+    if (!copy) {
+        return strerror(ENOMEM);
+    }
+    memcpy(copy, name, length + 1);
+
+    pthread_mutex_lock(&b->writing);
+    const char *why = NULL;
+    if (b->held == b->room) {
+        uint64_t room = b->room ? 2 * b->room : 1024;
+        member *m = (member *) realloc(b->members, room * sizeof(member));
+        if (m) {
+            b->members = m;
+            b->room = room;
+        } else {
+            why = strerror(ENOMEM);
+        }
+    }
+    if (!why && !writeAt(b->archive, w->out, w->have, b->end)) {
+        why = strerror(errno);
+    }
+    if (!why) {
+        b->members[b->held++] = (member) {
+            .e = { .offset = b->end, .packed = w->have, .raw = s->st_size,
+                   .permissions = s->st_mode, .name = length },
+            .name = copy,
+        };
+        b->end += w->have;
+    }
+    pthread_mutex_unlock(&b->writing);
+    if (why) {
+        free(copy);
+    }
+    return why;
+}
+
+static const char *codeFile(batch *b, worker *w, const char *name) {
+    const char *made = b->archive < 0 ? outputName(b, w, name) : name;
+    if (!made) {
+        return b->add ? strerror(ENOMEM) : "no suffix to take off";
+    }
+    int fileIn = open(name, O_RDONLY);
+    if (fileIn < 0) {
+        return strerror(errno);
+    }
+    struct stat s;
+    if (fstat(fileIn, &s) != 0 || !S_ISREG(s.st_mode)) {
+        close(fileIn);
+        return "not a regular file";
+    }
+    uint64_t written = w->written;
+    const char *why = NULL;
+    if (b->archive >= 0) { // Coded in memory, then added
+        w->have = 0;
+        why = b->c(w, fileIn, &s, -1);
+        close(fileIn);
+        if (!why) {
+            why = addMember(b, w, name, &s);
+            w->written += w->have;
+        }
+    } else {
+        int fileOut = open(made, O_CREAT | O_EXCL | O_WRONLY | O_TRUNC, 0644);
+        if (fileOut < 0) {
+            why = strerror(errno);
+            close(fileIn);
+            return why;
+        }
+        why = b->c(w, fileIn, &s, fileOut);
+        close(fileIn);
+        if (close(fileOut) != 0 && !why) {
+            why = strerror(errno);
+        }
+        if (why) {
+            unlink(made);
+        }
+    }
+    if (why) {
+        w->written = written;
+    } else {
+        w->read += s.st_size;
+    }
+    return why;
+}
+
+static void runNames(job *j) {
+    batchJob *bj = (batchJob *) j;
+    const char *name;
+    while ((name = nextName(bj->b, bj))) {
+        const char *why = codeFile(bj->b, &bj->w, name);
+        if (why) {
+            fprintf(stderr, "%s: %s: %s\n", bj->b->program, name, why);
+            bj->w.failed += 1;
+        }
+        bj->w.files += 1;
+    }
+    return;
+}
+
+// Directories on the way to a member are made as needed when it is taken out.
+
+static void makeParents(char *name) {
+    for (char *p = strchr(name, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        (void) mkdir(name, 0755); // If it is there already, so much the better
+        *p = '/';
+    }
+    return;
+}
+
+static const char *takeMember(batch *b, worker *w, const member *m) {
+    if (!safeName(m->name)) {
+        return "name is not below the current directory";
+    } else if (m->e.packed > UINT32_MAX
+               || !grow(&w->in, &w->inSize, m->e.packed ? m->e.packed : 1)) {
+        return strerror(ENOMEM);
+    } else if (!readAt(b->archive, w->in, m->e.packed, m->e.offset)) {
+        return "read of member failed";
+    }
+    makeParents(m->name);
+    int fileOut = open(m->name, O_CREAT | O_EXCL | O_WRONLY | O_TRUNC, 0644);
+    if (fileOut < 0) {
+        return strerror(errno);
+    }
+    uint64_t written = w->written;
+    const char *why = b->x(w, w->in, m->e.packed, fileOut);
+    if (close(fileOut) != 0 && !why) {
+        why = strerror(errno);
+    }
+    if (why) {
+        unlink(m->name);
+        w->written = written;
+    } else {
+        w->read += m->e.packed;
+    }
+    return why;
+}
+
+static void runMembers(job *j) {
+    batchJob *bj = (batchJob *) j;
+    batch *b = bj->b;
+    while (true) {
+        pthread_mutex_lock(&b->lock);
+        const member *m = b->next < b->count ? b->chosen[b->next++] : NULL;
+        pthread_mutex_unlock(&b->lock);
+        if (!m) {
+            break;
+        }
+        const char *why = takeMember(b, &bj->w, m);
+        if (why) {
+            fprintf(stderr, "%s: %s: %s\n", b->program, m->name, why);
+            bj->w.failed += 1;
+        }
+        bj->w.files += 1;
+    }
+    return;
+}
+
+// Run a job that calls run on each of threads workers, until they run out of
+// work, and add up what they did.
+
+static bool runJobs(batch *b, uint32_t threads, void (*run)(job *), bool verbose) {
+    threads = threads ? threads : cores();
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_mutex_init(&b->writing, NULL);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pool *p = newPool(threads);
+    batchJob *jobs = (batchJob *) calloc(threads, sizeof(batchJob));
+    if (!p || !jobs) {
+        delPool(p);
+        free(jobs);
+        pthread_mutex_destroy(&b->writing);
+        pthread_mutex_destroy(&b->lock);
+        fprintf(stderr, "%s: starting threads failed\n", b->program);
+        return false;
+    }
+    for (uint32_t i = 0; i < threads; i += 1) {
+        jobs[i].j.run = run;
+        jobs[i].b = b;
+        submit(p, &jobs[i].j);
+    }
+
+    worker total = { 0 };
+    for (uint32_t i = 0; i < threads; i += 1) {
+        worker *w = &jobs[i].w;
+        await(p, &jobs[i].j);
+        total.files += w->files;
+        total.failed += w->failed;
+        total.read += w->read;
+        total.written += w->written;
+        free(w->in);
+        free(w->out);
+        free(w->aux);
+        free(w->made);
+        free(jobs[i].line);
+    }
+    delPool(p);
+    free(jobs);
+    pthread_mutex_destroy(&b->writing);
+    pthread_mutex_destroy(&b->lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    seconds = seconds > 0 ? seconds : 1e-9;
+
+    if (verbose) {
+        fprintf(stderr, "%" PRIu64 " files (%" PRIu64 " failed) on %u thread%s: ", total.files,
+                total.failed, threads, threads == 1 ? "" : "s");
+        fprintf(stderr, "%" PRIu64 " bytes in, %" PRIu64 " bytes out", total.read, total.written);
+        fprintf(stderr, " in %.3lf s: %.0lf files/s, %.1lf MB/s in.\n", seconds,
+                total.files / seconds, total.read / seconds / (1024.0 * 1024.0));
+    }
+    return total.failed == 0;
+}
+
+bool runBatch(const char *program, char **names, uint32_t count, uint32_t threads,
+              const char *suffix, bool add, convert c, bool verbose) {
+    batch b = {
+        .program = program, .suffix = suffix, .add = add, .c = c,
+        .names = count ? names : NULL, .count = count, .archive = -1,
+    };
+    return runJobs(&b, threads, runNames, verbose);
+}
+
+// The members go in the order they are finished, and the Header last, once
+// their number is known.
+
+bool packBatch(const char *program, int archive, const uint8_t *shared, uint16_t sharedBytes,
+               char **names, uint32_t count, uint32_t threads, convert c, bool verbose) {
+    batch b = {
+        .program = program, .c = c, .names = count ? names : NULL, .count = count,
+        .archive = archive, .end = sizeof(Header) + sharedBytes,
+    };
+    bool ok = writeAt(archive, shared, sharedBytes, sizeof(Header))
+              && runJobs(&b, threads, runNames, verbose);
+
+    uint16_t mode = S_IFREG | 0644;
+    Header h = {
+        .magic = isBig() ? swap32(ARCHIVE) : ARCHIVE,
+        .permissions = isBig() ? swap16(mode) : mode,
+        .tree_size = isBig() ? swap16(sharedBytes) : sharedBytes,
+        .file_size = isBig() ? swap64(b.held) : b.held,
+    };
+    if (!writeDirectory(archive, b.end, b.members, b.held)
+        || !writeAt(archive, (const uint8_t *) &h, sizeof(Header), 0)) {
+        fprintf(stderr, "%s: writing the archive failed: %s\n", program, strerror(errno));
+        ok = false;
+    }
+    for (uint64_t i = 0; i < b.held; i += 1) {
+        free(b.members[i].name);
+    }
+    free(b.members);
+    return ok;
+}
+
+bool unpackBatch(const char *program, int archive, const directory *d, char **names,
+                 uint32_t count, uint32_t threads, expand x, bool verbose) {
+    uint64_t n = count ? count : d->count;
+    const member **chosen = (const member **) calloc(n ? n : 1, sizeof(member *));
+    if (!chosen) {
+        fprintf(stderr, "%s: %s\n", program, strerror(ENOMEM));
+        return false;
+    }
+    bool found = true;
+    uint64_t k = 0;
+    for (uint64_t i = 0; i < n; i += 1) {
+        const member *m = count ? findMember(d, names[i]) : &d->members[i];
+        if (m) {
+            chosen[k++] = m;
+        } else {
+            fprintf(stderr, "%s: %s: not in the archive\n", program, names[i]);
+            found = false;
+        }
+    }
+    batch b = {
+        .program = program, .x = x, .count = k, .archive = archive, .chosen = chosen,
+    };
+    bool ok = runJobs(&b, threads, runMembers, verbose);
+    free(chosen);
+    return ok && found;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "archive.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Batch mode codes many files in one process, so that a file costs neither a
+// process of its own nor the setup of one. The names come from the command
+// line, or else one to a line from standard input (so a manifest can simply
+// be redirected there). Each worker thread takes the next name as it is
+// free, and codes that file with buffers that it keeps from file to file.
+//
+// The output of name goes to name with suffix added, or with it taken off if
+// suffix is being removed (a name that does not end with it is an error).
+// A file that fails is reported and its output removed, and the batch goes
+// on with the rest.
+//
+// Packed into an archive, each file is instead coded in memory and added as a
+// member under its own name as soon as it is done. Taken out of one, each
+// member is decoded to its name, which must lie below the current directory.
+
+typedef struct worker {
+    uint8_t *in, *out, *aux; // Kept from file to file, grown as needed
+    uint32_t inSize, outSize, auxSize;
+    uint32_t have; // Bytes of out in use, when coding to memory
+    char *made; // The name of the output
+    size_t madeSize;
+    uint64_t files, failed; // Files done, and how many of them failed
+    uint64_t read, written; // Bytes of input and of output
+} worker;
+
+// Code the open file fileIn, whose status is s, to fileOut, and return NULL
+// or what went wrong. Output that the worker counts in written. If fileOut is
+// -1 the output is left in out instead, with its length in have.
+
+typedef const char *(*convert)(worker *w, int fileIn, const struct stat *s, int fileOut);
+
+// Run the batch on threads workers (all cores if zero), returning true if
+// every file was coded. With verbose set the totals and throughput follow.
+
+extern bool runBatch(const char *program, char **names, uint32_t count, uint32_t threads,
+                     const char *suffix, bool add, convert c, bool verbose);
+
+// Decode the n coded bytes at in to fileOut, as convert does.
+
+typedef const char *(*expand)(worker *w, const uint8_t *in, uint64_t n, int fileOut);
+
+// Pack the files into the new archive open as archive, with sharedBytes at
+// shared following the Header (see archive.h).
+
+extern bool packBatch(const char *program, int archive, const uint8_t *shared,
+                      uint16_t sharedBytes, char **names, uint32_t count, uint32_t threads,
+                      convert c, bool verbose);
+
+// Take the count named members (all of them if count is zero) out of the
+// archive whose directory is d.
+
+extern bool unpackBatch(const char *program, int archive, const directory *d, char **names,
+                        uint32_t count, uint32_t threads, expand x, bool verbose);
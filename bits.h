@@ -0,0 +1,211 @@
+#pragma once
+
+#include "endian.h"
+#include "io.h"
+#include "sizes.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+// A bitReader hands out bits in the same order that a bitWriter appends them:
+// the least significant bit of each byte first. Up to 64 bits are kept in
+// bits, with the next bit to be read in bit 0, so that a decoder can peek at
+// many bits at once and only then decide how many of them it consumed.
+
+typedef struct bitReader {
+    uint64_t bits; // Buffered bits, next bit is bit 0
+    uint32_t count; // Number of buffered bits
+    uint32_t extra; // Zero bits supplied past the end of the input
+    const uint8_t *p, *end; // Unread bytes
+    int file; // Refill from this file once the bytes run out (-1 for none)
+    uint8_t *buffer; // Room for size bytes read from file
+    uint32_t size;
+} bitReader;
+
+// Read the bits of a file through a buffer supplied by the caller.
+
+static inline void newReader(bitReader *r, int file, uint8_t *buffer, uint32_t size) {
+    r->bits = 0;
+    r->count = 0;
+    r->extra = 0;
+    r->p = r->end = buffer;
+    r->file = file;
+    r->buffer = buffer;
+    r->size = size;
+    return;
+}
+
+// Read the bits of n bytes that are already in memory.
+
+static inline void newMemoryReader(bitReader *r, const uint8_t *b, size_t n) {
+    newReader(r, -1, NULL, 0);
+    r->p = b;
+    r->end = b + n;
+    return;
+}
+
+// Top up the bit buffer to at least 57 bits. Once the input is exhausted we
+// pretend that it is followed by zeros, and count how many we made up.
+
+static inline void refill(bitReader *r) {
+    if (r->end - r->p >= 8) { // Fast path: take whole bytes with one load
+        uint64_t word;
+        memcpy(&word, r->p, 8);
+        word = isBig() ? swap64(word) : word;
+        r->bits |= word << r->count;
+        r->p += (63 - r->count) / 8;
+        r->count |= 56;
+        return;
+    }
+    while (r->count <= 56) {
+        if (r->p == r->end) {
+            long length = r->file < 0 ? 0 : read(r->file, r->buffer, r->size);
+            if (length <= 0) {
+                r->extra += 64 - r->count;
+                r->count = 64;
+                return;
+            }
+            r->p = r->buffer;
+            r->end = r->buffer + length;
+        }
+        r->bits |= (uint64_t) *r->p++ << r->count;
+        r->count += 8;
+    }
+    return;
+}
+
+static inline uint32_t peekBits(bitReader *r, uint32_t n) {
+    if (r->count < n) {
+        refill(r);
+    }
+    return (uint32_t) (r->bits & ((UINT64_C(1) << n) - 1));
+}
+
+static inline void skipBits(bitReader *r, uint32_t n) {
+    r->bits >>= n;
+    r->count -= n;
+    return;
+}
+
+// True once a decoder has consumed bits that were not in the input.
+
+static inline bool exhausted(bitReader *r) {
+    return r->extra > r->count;
+}
+
+// A bitWriter collects codes in a 64-bit accumulator, first bit in bit 0, and
+// moves it to the output buffer eight bytes at a time. The buffer is written
+// to file whenever it fills. Without a file the buffer is all the room there
+// is, and running out of it sets overflow. A write to the file that fails
+// sets failed, with errno saying why, and what follows is dropped.
+
+typedef struct bitWriter {
+    uint64_t bits; // Pending bits, first bit in bit 0
+    uint32_t count; // Number of pending bits (always less than 64)
+    bool overflow; // Set if the buffer filled and there is no file
+    bool failed; // Set if a write to the file failed
+    size_t p; // Number of bytes in buffer
+    uint64_t total; // Total number of bits appended
+    int file; // Write full buffers to this file (-1 for none)
+    uint8_t *buffer; // Room for size bytes
+    size_t size;
+} bitWriter;
+
+static inline void newWriter(bitWriter *w, int file, uint8_t *buffer, size_t size) {
+    w->bits = 0;
+    w->count = 0;
+    w->overflow = false;
+    w->failed = false;
+    w->p = 0;
+    w->total = 0;
+    w->file = file;
+    w->buffer = buffer;
+    w->size = size;
+    return;
+}
+
+// Write out the whole buffer and empty it.
+
+static inline void writeBuffer(bitWriter *w) {
+    w->failed = w->failed || !writeFully(w->file, w->buffer, w->p);
+    w->p = 0;
+    return;
+}
+
+// Make room for n more bytes, returning false if there is none.
+
+static inline bool roomFor(bitWriter *w, size_t n) {
+    if (w->p + n > w->size) {
+        if (w->file < 0) {
+            w->overflow = true;
+            return false;
+        }
+        writeBuffer(w);
+    }
+    return true;
+}
+
+static inline void putWord(bitWriter *w, uint64_t word) {
+    if (!roomFor(w, 8)) {
+        return;
+    }
+    word = isBig() ? swap64(word) : word;
+    memcpy(w->buffer + w->p, &word, 8);
+    w->p += 8;
+    return;
+}
+
+// Append the low n bits of bits (n <= 64, nothing above bit n may be set).
+// Whatever does not fit in the accumulator is carried over into the next one.
+
+static inline void putBits(bitWriter *w, uint64_t bits, uint32_t n) {
+    w->total += n;
+    w->bits |= bits << w->count;
+    if (w->count + n >= 64) {
+        putWord(w, w->bits);
+        w->bits = w->count ? bits >> (64 - w->count) : 0;
+        w->count = w->count + n - 64;
+    } else {
+        w->count += n;
+    }
+    return;
+}
+
+// Write out every whole byte appended so far, keeping back only the bits of
+// a last partial byte, so that a reader can get them without waiting.
+
+static inline void drainWriter(bitWriter *w) {
+    for (; w->count >= 8; w->count -= 8) {
+        if (!roomFor(w, 1)) {
+            return;
+        }
+        w->buffer[w->p] = (uint8_t) w->bits;
+        w->p += 1;
+        w->bits >>= 8;
+    }
+    if (w->p && w->file >= 0) {
+        writeBuffer(w);
+    }
+    return;
+}
+
+// Write out the pending bits, padding the last byte with zeros. Without a
+// file the bytes stay in the buffer, and p is the length of the output.
+
+static inline void flushWriter(bitWriter *w) {
+    for (uint32_t i = 0; i < w->count; i += 8) {
+        if (!roomFor(w, 1)) {
+            return;
+        }
+        w->buffer[w->p] = (uint8_t) (w->bits >> i);
+        w->p += 1;
+    }
+    if (w->p && w->file >= 0) {
+        writeBuffer(w);
+    }
+    w->bits = 0;
+    w->count = 0;
+    return;
+}
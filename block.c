@@ -0,0 +1,755 @@
+#include "block.h"
+
+#include "bits.h"
+#include "bwt.h"
+#include "endian.h"
+#include "canon.h"
+#include "code.h"
+#include "context.h"
+#include "histogram.h"
+#include "huffman.h"
+#include "io.h"
+#include "lz77.h"
+#include "runs.h"
+#include "table.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static uint32_t storeBlock(const uint8_t *in, uint32_t n, uint8_t *out) {
+    out[0] = STORED;
+    memcpy(out + 1, in, n);
+    return n + 1;
+}
+
+// Append the codes of n bytes, each with the code of its context, and flush
+// them, returning false if they did not fit in the writer's buffer. An
+// order-0 code is the same code for every context.
+
+static bool putSymbols(bitWriter *w, const wordCode *const c[BYTE], const uint8_t *in, uint32_t n) {
+    uint8_t last = 0;
+    for (uint32_t i = 0; i < n && !w->overflow; i += 1) {
+        putBits(w, c[last][in[i]].bits, c[last][in[i]].l);
+        last = in[i];
+    }
+    flushWriter(w);
+    return !w->overflow;
+}
+
+// With STREAMS streams the bytes are cut into that many parts, and the codes
+// of each part go into a stream of their own. All but the last stream are
+// preceded by their size in a jump table at out + jump, so that a decoder can
+// start on all of them at once. The streams start at out + p, and the block
+// may not grow past n + 1 bytes. Returns the size of the block, or zero if it
+// would be too big.
+
+static uint32_t putStreams(const wordCode *const c[BYTE], const uint8_t *in, uint32_t n,
+                           uint8_t *out, uint32_t jump, uint32_t p, uint32_t parts) {
+    uint32_t part = n / parts;
+    for (uint32_t k = 0; k < parts; k += 1) {
+        uint32_t count = k < parts - 1 ? part : n - k * part;
+        bitWriter writer;
+        newWriter(&writer, -1, out + p, n + 1 - p);
+        if (!putSymbols(&writer, c, in + k * part, count)) {
+            return 0;
+        }
+        if (k < parts - 1) {
+            uint32_t size = isBig() ? swap32((uint32_t) writer.p) : (uint32_t) writer.p;
+            memcpy(out + jump + 4 * k, &size, 4);
+        }
+        p += writer.p;
+    }
+    return p;
+}
+
+// An order-1 code, if clustering the contexts finds one that beats an order-0
+// code for the block, and fits in n + 1 bytes. Returns zero otherwise. Each
+// part starts with context 0, as the decoder of its stream will.
+
+static uint32_t encodeContexts(const uint8_t *in, uint32_t n, uint8_t *out, uint32_t limit,
+                               uint32_t parts, uint32_t clusters) {
+    uint32_t (*pairs)[BYTE] = (uint32_t (*)[BYTE]) calloc(BYTE, sizeof(*pairs));
+    if (!pairs) {
+        return 0;
+    }
+    for (uint32_t k = 0, part = n / parts; k < parts; k += 1) {
+        countPairs(in + k * part, k < parts - 1 ? part : n - k * part, pairs);
+    }
+    uint8_t map[BYTE], lengths[CLUSTERS][BYTE];
+    uint32_t k = clusterContexts(pairs, clusters, limit, map, lengths);
+    free(pairs);
+    if (k < 2) {
+        return 0;
+    }
+
+    uint8_t head[2 + BYTE / 2 + CLUSTERS * (2 + LENGTHS)];
+    uint32_t p = 2 + BYTE / 2;
+    head[0] = parts == STREAMS ? CONTEXT4 : CONTEXT;
+    head[1] = k;
+    for (uint32_t x = 0; x < BYTE; x += 2) {
+        head[2 + x / 2] = map[x] | map[x + 1] << 4;
+    }
+    wordCode w[CLUSTERS][BYTE];
+    for (uint32_t j = 0; j < k; j += 1) {
+        code c[BYTE];
+        if (!canonicalCodes(lengths[j], BYTE, c)) {
+            return 0;
+        }
+        for (uint32_t i = 0; i < BYTE; i += 1) {
+            w[j][i] = toWord(c[i]);
+        }
+        uint16_t tableBytes = dumpLengths(lengths[j], BYTE, head + p + 2);
+        head[p] = tableBytes & 0xFF;
+        head[p + 1] = tableBytes >> 8;
+        p += 2 + tableBytes;
+    }
+    if (p + 4 * (parts - 1) >= n + 1) {
+        return 0;
+    }
+    memcpy(out, head, p);
+
+    const wordCode *byContext[BYTE];
+    for (uint32_t x = 0; x < BYTE; x += 1) {
+        byContext[x] = w[map[x]];
+    }
+    return putStreams(byContext, in, n, out, p, p + 4 * (parts - 1), parts);
+}
+
+// Code n bytes with a canonical code of their own (no code longer than limit
+// bits, unless limit is zero) and return the number of bytes placed in out.
+// With more than one cluster, an order-1 code with up to that many code
+// tables is tried first. If coding would not make the block smaller it is
+// stored instead. A block holds fewer than 2^32 symbols, so no code is longer
+// than 46 bits and every code fits in a word.
+
+static uint32_t encodeCodes(const uint8_t *in, uint32_t n, uint8_t *out, uint32_t limit,
+                            uint32_t streams, uint32_t clusters) {
+    uint32_t parts = streams == STREAMS ? STREAMS : 1;
+    if (clusters > 1) {
+        uint32_t packed = encodeContexts(in, n, out, limit, parts, clusters);
+        if (packed) {
+            return packed;
+        }
+    }
+
+    uint64_t hist[BYTE] = { 0 };
+    countBytes(in, n, hist);
+
+    uint8_t lengths[BYTE];
+    code c[BYTE];
+    if (!huffmanLengths(hist, BYTE, lengths) || (limit && !limitLengths(hist, lengths, BYTE, limit))
+        || !canonicalCodes(lengths, BYTE, c)) {
+        return storeBlock(in, n, out);
+    }
+
+    wordCode w[BYTE];
+    const wordCode *byContext[BYTE];
+    for (uint32_t i = 0; i < BYTE; i += 1) {
+        w[i] = toWord(c[i]);
+        byContext[i] = w;
+    }
+
+    uint16_t tableBytes = dumpLengths(lengths, BYTE, out + 3);
+    uint32_t head = 3 + tableBytes + 4 * (parts - 1);
+    if (head >= n + 1) {
+        return storeBlock(in, n, out);
+    }
+    out[0] = parts == STREAMS ? HUFFMAN4 : HUFFMAN;
+    out[1] = tableBytes & 0xFF;
+    out[2] = tableBytes >> 8;
+
+    uint32_t packed = putStreams(byContext, in, n, out, 3 + tableBytes, head, parts);
+    return packed ? packed : storeBlock(in, n, out);
+}
+
+// The code lengths of one alphabet of a MATCHES block, saved at out + p
+// behind two bytes of their size if they fit below end. Returns the bytes
+// that they took, or zero.
+
+static uint32_t putMatchCodes(uint64_t hist[], uint32_t symbols, uint32_t limit, wordCode w[],
+                              uint8_t *out, uint32_t p, uint32_t end) {
+    uint8_t lengths[LITERALS];
+    code c[LITERALS];
+    if (!huffmanLengths(hist, symbols, lengths) || !limitLengths(hist, lengths, symbols, limit)
+        || !canonicalCodes(lengths, symbols, c) || p + 2 + LENGTHSOF(symbols) > end) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < symbols; i += 1) {
+        w[i] = toWord(c[i]);
+    }
+    uint16_t tableBytes = dumpLengths(lengths, symbols, out + p + 2);
+    out[p] = tableBytes & 0xFF;
+    out[p + 1] = tableBytes >> 8;
+    return 2 + tableBytes;
+}
+
+// Code n bytes as literals and matches (see lz77.h), with no code longer
+// than MATCHBITS so that a whole match can be read after a refill or two.
+// Returns the size of the block, or zero if it would not fit in n + 1 bytes.
+
+static uint32_t encodeMatches(const uint8_t *in, uint32_t n, uint8_t *out, uint32_t limit,
+                              uint32_t level, uint32_t window) {
+    match *m = (match *) malloc((n ? n : 1) * sizeof(match));
+    if (!m) {
+        return 0;
+    }
+    uint32_t count = findMatches(in, n, level, window, m);
+
+    uint64_t literals[LITERALS] = { 0 }, distances[DISTANCES] = { 0 };
+    for (uint32_t i = 0; i < count; i += 1) {
+        if (m[i].distance) {
+            literals[BYTE + slotOf(m[i].length - MINMATCH)] += 1;
+            distances[slotOf(m[i].distance - 1)] += 1;
+        } else {
+            literals[m[i].length] += 1;
+        }
+    }
+
+    wordCode l[LITERALS], d[DISTANCES];
+    limit = limit && limit < MATCHBITS ? limit : MATCHBITS;
+    uint32_t p = 1, bytes = putMatchCodes(literals, LITERALS, limit, l, out, p, n + 1);
+    p += bytes;
+    bytes = bytes ? putMatchCodes(distances, DISTANCES, limit, d, out, p, n + 1) : 0;
+    p += bytes;
+    if (!bytes) {
+        free(m);
+        return 0;
+    }
+    out[0] = MATCHES;
+
+    bitWriter w;
+    newWriter(&w, -1, out + p, n + 1 - p);
+    for (uint32_t i = 0; i < count && !w.overflow; i += 1) {
+        if (m[i].distance) {
+            uint32_t v = m[i].length - MINMATCH, s = slotOf(v);
+            putBits(&w, l[BYTE + s].bits, l[BYTE + s].l);
+            putBits(&w, v - slotBase(s), slotBits(s));
+            v = m[i].distance - 1;
+            s = slotOf(v);
+            putBits(&w, d[s].bits, d[s].l);
+            putBits(&w, v - slotBase(s), slotBits(s));
+        } else {
+            putBits(&w, l[m[i].length].bits, l[m[i].length].l);
+        }
+    }
+    flushWriter(&w);
+    free(m);
+    return w.overflow ? 0 : p + (uint32_t) w.p;
+}
+
+static void putSize(uint8_t *b, uint32_t x) {
+    x = isBig() ? swap32(x) : x;
+    memcpy(b, &x, 4);
+    return;
+}
+
+// The i-th 16-bit symbol of n bytes, little endian, the last padded with a
+// zero byte if n is odd.
+
+static inline uint16_t wordAt(const uint8_t *in, uint32_t n, uint32_t i) {
+    return in[2 * i] | (2 * i + 1 < n ? in[2 * i + 1] << 8 : 0);
+}
+
+// Code n bytes as 16-bit symbols with a canonical code of their own (no code
+// longer than limit bits, unless limit is zero). Returns the size of the
+// block, or zero if it would not fit in n + 1 bytes.
+
+static uint32_t encodeWords(const uint8_t *in, uint32_t n, uint8_t *out, uint32_t limit) {
+    uint32_t words = (n + 1) / 2, packed = 0;
+    uint64_t *hist = (uint64_t *) calloc(WORD, sizeof(uint64_t));
+    uint8_t *lengths = (uint8_t *) calloc(WORD, 1), *saved = (uint8_t *) malloc(LENGTHSOF(WORD));
+    code *c = (code *) malloc(WORD * sizeof(code));
+    wordCode *w = (wordCode *) malloc(WORD * sizeof(wordCode));
+    if (hist && lengths && saved && c && w) {
+        for (uint32_t i = 0; i < words; i += 1) {
+            hist[wordAt(in, n, i)] += 1;
+        }
+        bool ok = huffmanLengths(hist, WORD, lengths)
+                  && (!limit || limitLengths(hist, lengths, WORD, limit))
+                  && canonicalCodes(lengths, WORD, c);
+        uint32_t tableBytes = ok ? dumpLengths(lengths, WORD, saved) : 0;
+        if (ok && 5 + tableBytes < n + 1) {
+            out[0] = WIDE;
+            putSize(out + 1, tableBytes);
+            memcpy(out + 5, saved, tableBytes);
+            for (uint32_t s = 0; s < WORD; s += 1) {
+                w[s] = toWord(c[s]);
+            }
+            bitWriter writer;
+            newWriter(&writer, -1, out + 5 + tableBytes, n + 1 - 5 - tableBytes);
+            for (uint32_t i = 0; i < words && !writer.overflow; i += 1) {
+                uint16_t s = wordAt(in, n, i);
+                putBits(&writer, w[s].bits, w[s].l);
+            }
+            flushWriter(&writer);
+            packed = writer.overflow ? 0 : 5 + tableBytes + (uint32_t) writer.p;
+        }
+    }
+    free(hist);
+    free(lengths);
+    free(saved);
+    free(c);
+    free(w);
+    return packed;
+}
+
+// Code the m transformed bytes at t as a block of their own, inside a block
+// of the given method whose head bytes say how to undo the transform, if that
+// is smaller than packed bytes.
+
+static uint32_t encodeInner(const uint8_t *t, uint32_t m, uint8_t *out, uint32_t packed,
+                            uint8_t method, const uint8_t *head, uint32_t heads, uint32_t limit,
+                            uint32_t streams, uint32_t clusters, uint32_t transforms,
+                            uint32_t level, uint32_t window) {
+    uint8_t *inner = (uint8_t *) malloc(BLOCKBOUND(m));
+    if (inner) {
+        uint32_t p = encodeBlock(t, m, inner, limit, streams, clusters, transforms, level, window);
+        if (1 + heads + p < packed) {
+            out[0] = method;
+            memcpy(out + 1, head, heads);
+            memcpy(out + 1 + heads, inner, p);
+            packed = 1 + heads + p;
+        }
+    }
+    free(inner);
+    return packed;
+}
+
+// Code the bytes as encodeCodes does, and then with matches if a level is
+// given, and, for each transform asked for, code the transformed bytes as
+// well, keeping whichever is smallest.
+
+uint32_t encodeBlock(const uint8_t *in, uint32_t n, uint8_t *out, uint32_t limit, uint32_t streams,
+                     uint32_t clusters, uint32_t transforms, uint32_t level, uint32_t window) {
+    uint32_t packed = encodeCodes(in, n, out, limit, streams, clusters);
+    uint8_t head[8];
+
+    if (level) {
+        uint8_t *matches = (uint8_t *) malloc(n + 1);
+        uint32_t p = matches ? encodeMatches(in, n, matches, limit, level, window) : 0;
+        if (p && p < packed) {
+            memcpy(out, matches, p);
+            packed = p;
+        }
+        free(matches);
+    }
+
+    if ((transforms & WORDS) && n > 0) {
+        uint8_t *words = (uint8_t *) malloc(n + 1);
+        uint32_t p = words ? encodeWords(in, n, words, limit) : 0;
+        if (p && p < packed) {
+            memcpy(out, words, p);
+            packed = p;
+        }
+        free(words);
+    }
+
+    if (transforms & RLE) {
+        uint8_t *runs = (uint8_t *) malloc(RUNSBOUND(n));
+        uint32_t m = runs ? packRuns(in, n, runs) : n;
+        if (m < n) {
+            putSize(head, m);
+            packed = encodeInner(runs, m, out, packed, RUNS, head, 4, limit, streams, clusters,
+                                 transforms & ~RLE, level, window);
+        }
+        free(runs);
+    }
+
+    if ((transforms & BWT) && n <= BWTMAX) {
+        uint8_t *sorted = (uint8_t *) malloc(n ? n : 1), *ranks = (uint8_t *) malloc(RANKSBOUND(n));
+        uint32_t primary;
+        if (sorted && ranks && sortBlock(in, n, sorted, &primary)) {
+            uint32_t m = packRanks(sorted, n, ranks);
+            putSize(head, primary);
+            putSize(head + 4, m);
+            packed = encodeInner(ranks, m, out, packed, SORTED, head, 8, limit, streams, clusters,
+                                 transforms & ~(RLE | BWT), 0, 0);
+        }
+        free(sorted);
+        free(ranks);
+    }
+    return packed;
+}
+
+// Top up a reader that has at least 8 bytes left, and decode a symbol from
+// bits that are known to be there already.
+
+static inline void fastRefill(bitReader *r) {
+    uint64_t word;
+    memcpy(&word, r->p, 8);
+    r->bits |= (isBig() ? swap64(word) : word) << r->count;
+    r->p += (63 - r->count) / 8;
+    r->count |= 56;
+    return;
+}
+
+static inline uint8_t fastSymbol(const entry *e, bitReader *r) {
+    entry x = e[r->bits & ((1 << LOOKUP) - 1)];
+    while (x.link) {
+        r->bits >>= x.length;
+        r->count -= x.length;
+        x = e[(1 << LOOKUP) + (x.value << SUBBITS) + (r->bits & ((1 << SUBBITS) - 1))];
+    }
+    r->bits >>= x.length;
+    r->count -= x.length;
+    return (uint8_t) x.value;
+}
+
+// Decode raw bytes from STREAMS streams of the given sizes, a symbol from
+// each stream in turn, so that the lookups of the streams can overlap. Each
+// symbol is decoded with the table of its context, the symbol before it in
+// its stream. After each refill every stream has at least 56 bits, enough for
+// 56 / longest symbols, so the inner loop does not check. The last stream also
+// has the bytes that are left over, and the ends of the streams are decoded
+// with the careful decodeSymbol.
+
+static bool decodeStreams(table *const t[BYTE], const uint8_t *in, uint32_t size[],
+                          uint32_t longest, uint8_t *out, uint32_t raw) {
+    _Static_assert(STREAMS == 4, "one reader per stream");
+    bitReader r0, r1, r2, r3;
+    newMemoryReader(&r0, in, size[0]);
+    newMemoryReader(&r1, in + size[0], size[1]);
+    newMemoryReader(&r2, in + size[0] + size[1], size[2]);
+    newMemoryReader(&r3, in + size[0] + size[1] + size[2], size[3]);
+
+    const entry *e[BYTE];
+    for (uint32_t x = 0; x < BYTE; x += 1) {
+        e[x] = t[x]->e;
+    }
+
+    uint32_t part = raw / STREAMS, per = 56 / longest, i = 0;
+    uint8_t *o0 = out, *o1 = out + part, *o2 = out + 2 * part, *o3 = out + 3 * part;
+    uint8_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+    while (per > 0 && i + per <= part && r0.end - r0.p >= 8 && r1.end - r1.p >= 8
+           && r2.end - r2.p >= 8 && r3.end - r3.p >= 8) {
+        fastRefill(&r0);
+        fastRefill(&r1);
+        fastRefill(&r2);
+        fastRefill(&r3);
+        for (uint32_t j = 0; j < per; j += 1) {
+            o0[i + j] = c0 = fastSymbol(e[c0], &r0);
+            o1[i + j] = c1 = fastSymbol(e[c1], &r1);
+            o2[i + j] = c2 = fastSymbol(e[c2], &r2);
+            o3[i + j] = c3 = fastSymbol(e[c3], &r3);
+        }
+        i += per;
+    }
+    for (uint32_t j = i; j < part; j += 1) {
+        o0[j] = c0 = decodeSymbol(t[c0], &r0);
+        o1[j] = c1 = decodeSymbol(t[c1], &r1);
+        o2[j] = c2 = decodeSymbol(t[c2], &r2);
+    }
+    for (; i < raw - 3 * part; i += 1) {
+        o3[i] = c3 = decodeSymbol(t[c3], &r3);
+    }
+    return !exhausted(&r0) && !exhausted(&r1) && !exhausted(&r2) && !exhausted(&r3);
+}
+
+// Load the code lengths of an alphabet of symbols that are saved at
+// in[p, packed) behind their size (sizeBytes bytes, little endian), build a
+// table for them, and say how far the table went and how long its longest
+// code is. Returns NULL if they do not make sense.
+
+static table *readTable(const uint8_t *in, uint32_t packed, uint32_t *p, uint32_t sizeBytes,
+                        uint32_t symbols, uint32_t *longest) {
+    if (*p + sizeBytes > packed) {
+        return NULL;
+    }
+    uint32_t tableBytes = 0;
+    for (uint32_t i = 0; i < sizeBytes; i += 1) {
+        tableBytes |= (uint32_t) in[*p + i] << (8 * i);
+    }
+    if (tableBytes > packed - *p - sizeBytes) {
+        return NULL;
+    }
+
+    uint8_t *lengths = (uint8_t *) malloc(symbols);
+    code *c = (code *) malloc(symbols * sizeof(code));
+    table *t = NULL;
+    if (lengths && c && loadLengths(in + *p + sizeBytes, tableBytes, symbols, lengths)
+        && canonicalCodes(lengths, symbols, c)) {
+        for (uint32_t i = 0; i < symbols; i += 1) {
+            *longest = lengths[i] > *longest ? lengths[i] : *longest;
+        }
+        *p += sizeBytes + tableBytes;
+        t = newTable(c, symbols);
+    }
+    free(lengths);
+    free(c);
+    return t;
+}
+
+// Decode the 16-bit symbols of a WIDE block, which make two bytes each but
+// the last of an odd block, whose top byte must be zero.
+
+static bool decodeWords(const uint8_t *in, uint32_t packed, uint8_t *out, uint32_t raw) {
+    uint32_t p = 1, longest = 1;
+    table *t = readTable(in, packed, &p, 4, WORD, &longest);
+    if (!t) {
+        return false;
+    }
+    bitReader r;
+    newMemoryReader(&r, in + p, packed - p);
+    uint32_t i = 0;
+    for (; i + 2 <= raw; i += 2) {
+        uint16_t s = decodeSymbol(t, &r);
+        out[i] = s & 0xFF;
+        out[i + 1] = s >> 8;
+    }
+    bool ok = true;
+    if (i < raw) {
+        uint16_t s = decodeSymbol(t, &r);
+        out[i] = s & 0xFF;
+        ok = s >> 8 == 0;
+    }
+    delTable(t);
+    return ok && !exhausted(&r);
+}
+
+// Decode the literals and matches of a MATCHES block. A match may overlap the
+// bytes that it copies, which repeats them; one from at least a word back is
+// copied a word at a time when there is room for the last word to spill over.
+
+static bool decodeMatches(const uint8_t *in, uint32_t packed, uint8_t *out, uint32_t raw) {
+    uint32_t p = 1, longest = 1;
+    table *l = readTable(in, packed, &p, 2, LITERALS, &longest);
+    table *d = l ? readTable(in, packed, &p, 2, DISTANCES, &longest) : NULL;
+    bool ok = d != NULL;
+
+    bitReader r;
+    newMemoryReader(&r, in + p, packed - p);
+    for (uint32_t o = 0; ok && o < raw;) {
+        uint32_t s = decodeSymbol(l, &r);
+        if (s < BYTE) {
+            out[o++] = s;
+            continue;
+        }
+        s -= BYTE;
+        uint32_t length = MINMATCH + slotBase(s) + peekBits(&r, slotBits(s));
+        skipBits(&r, slotBits(s));
+        s = decodeSymbol(d, &r);
+        uint32_t distance = 1 + slotBase(s) + peekBits(&r, slotBits(s));
+        skipBits(&r, slotBits(s));
+        if (distance > o || length > raw - o) {
+            ok = false;
+            break;
+        }
+        uint8_t *to = out + o;
+        const uint8_t *from = to - distance;
+        if (distance >= 8 && raw - o >= length + 8) {
+            for (uint32_t k = 0; k < length; k += 8) {
+                memcpy(to + k, from + k, 8);
+            }
+        } else {
+            for (uint32_t k = 0; k < length; k += 1) {
+                to[k] = from[k];
+            }
+        }
+        o += length;
+    }
+    ok = ok && !exhausted(&r);
+    delTable(l);
+    delTable(d);
+    return ok;
+}
+
+// Decode a block of packed bytes into exactly raw bytes, returning false if
+// the block does not make sense. As when encoding, a transform is only
+// allowed once: the block inside RUNS may be SORTED but not RUNS again, and
+// the block inside SORTED is coded directly.
+
+static bool decodeInner(const uint8_t *in, uint32_t packed, uint8_t *out, uint32_t raw,
+                        uint32_t transforms) {
+    if (packed < 1) {
+        return false;
+    } else if (in[0] == STORED) {
+        if (packed - 1 != raw) {
+            return false;
+        }
+        memcpy(out, in + 1, raw);
+        return true;
+    } else if (in[0] == RUNS) {
+        uint32_t m;
+        if (packed < 5 || !(transforms & RLE)) {
+            return false;
+        }
+        memcpy(&m, in + 1, 4);
+        m = isBig() ? swap32(m) : m;
+        if (m > RUNSBOUND(raw) || m > MAXBLOCK) {
+            return false;
+        }
+        uint8_t *runs = (uint8_t *) malloc(m ? m : 1);
+        bool ok = runs && decodeInner(in + 5, packed - 5, runs, m, transforms & ~RLE)
+                  && unpackRuns(runs, m, out, raw);
+        free(runs);
+        return ok;
+    } else if (in[0] == WIDE) {
+        return decodeWords(in, packed, out, raw);
+    } else if (in[0] == MATCHES) {
+        return decodeMatches(in, packed, out, raw);
+    } else if (in[0] == SORTED) {
+        uint32_t primary, m;
+        if (packed < 9 || !(transforms & BWT)) {
+            return false;
+        }
+        memcpy(&primary, in + 1, 4);
+        memcpy(&m, in + 5, 4);
+        primary = isBig() ? swap32(primary) : primary;
+        m = isBig() ? swap32(m) : m;
+        if (raw > BWTMAX || primary > raw || m > RANKSBOUND(raw)) {
+            return false;
+        }
+        uint8_t *ranks = (uint8_t *) malloc(m ? m : 1), *sorted = (uint8_t *) malloc(raw ? raw : 1);
+        bool ok = ranks && sorted
+                  && decodeInner(in + 9, packed - 9, ranks, m, transforms & ~(RLE | BWT))
+                  && unpackRanks(ranks, m, sorted, raw) && unsortBlock(sorted, raw, primary, out);
+        free(ranks);
+        free(sorted);
+        return ok;
+    } else if (in[0] != HUFFMAN && in[0] != HUFFMAN4 && in[0] != CONTEXT && in[0] != CONTEXT4) {
+        return false;
+    }
+
+    // One table for an order-0 code, or one for each cluster of contexts.
+
+    bool split = in[0] == HUFFMAN4 || in[0] == CONTEXT4;
+    bool contexts = in[0] == CONTEXT || in[0] == CONTEXT4;
+    uint32_t k = 1, p = 1, longest = 1;
+    uint8_t map[BYTE] = { 0 };
+    if (contexts) {
+        if (packed < 2 + BYTE / 2 || in[1] < 2 || in[1] > CLUSTERS) {
+            return false;
+        }
+        k = in[1];
+        for (uint32_t x = 0; x < BYTE; x += 1) {
+            map[x] = in[2 + x / 2] >> (4 * (x % 2)) & 0xF;
+            if (map[x] >= k) {
+                return false;
+            }
+        }
+        p = 2 + BYTE / 2;
+    }
+    table *tables[CLUSTERS] = { NULL };
+    bool ok = true;
+    for (uint32_t j = 0; j < k && ok; j += 1) {
+        tables[j] = readTable(in, packed, &p, 2, BYTE, &longest);
+        ok = tables[j] != NULL;
+    }
+    table *byContext[BYTE];
+    for (uint32_t x = 0; x < BYTE; x += 1) {
+        byContext[x] = tables[map[x]];
+    }
+
+    uint32_t head = p + (split ? 4 * (STREAMS - 1) : 0);
+    uint32_t size[STREAMS], left = ok && head <= packed ? packed - head : 0;
+    ok = ok && head <= packed;
+    for (uint32_t j = 0; ok && split && j < STREAMS - 1; j += 1) {
+        memcpy(&size[j], in + p + 4 * j, 4);
+        size[j] = isBig() ? swap32(size[j]) : size[j];
+        ok = size[j] <= left;
+        left -= ok ? size[j] : 0;
+    }
+    size[STREAMS - 1] = left;
+
+    if (ok && split) {
+        ok = decodeStreams(byContext, in + head, size, longest, out, raw);
+    } else if (ok && contexts) {
+        bitReader r;
+        newMemoryReader(&r, in + head, packed - head);
+        uint8_t last = 0;
+        for (uint32_t i = 0; i < raw; i += 1) {
+            out[i] = last = decodeSymbol(byContext[last], &r);
+        }
+        ok = !exhausted(&r);
+    } else if (ok) {
+        bitReader r;
+        newMemoryReader(&r, in + head, packed - head);
+        for (uint32_t i = 0; i < raw; i += 1) {
+            out[i] = decodeSymbol(tables[0], &r);
+        }
+        ok = !exhausted(&r);
+    }
+    for (uint32_t j = 0; j < k; j += 1) {
+        delTable(tables[j]);
+    }
+    return ok;
+}
+
+bool decodeBlock(const uint8_t *in, uint32_t packed, uint8_t *out, uint32_t raw) {
+    return decodeInner(in, packed, out, raw, RLE | BWT);
+}
+
+// The index and its trailer, little endian like everything else.
+
+void packIndex(const Index *index, uint64_t n, uint8_t *b) {
+    for (uint64_t i = 0; i < n; i += 1) {
+        Index x = {
+            .offset = isBig() ? swap64(index[i].offset) : index[i].offset,
+            .position = isBig() ? swap64(index[i].position) : index[i].position,
+        };
+        memcpy(b + i * sizeof(Index), &x, sizeof(Index));
+    }
+    return;
+}
+
+Trailer packTrailer(uint64_t blocks) {
+    Trailer t = {
+        .blocks = isBig() ? swap64(blocks) : blocks,
+        .reserved = 0,
+        .magic = isBig() ? swap32(INDEX) : INDEX,
+    };
+    return t;
+}
+
+bool writeIndex(int file, Index *index, uint64_t blocks) {
+    uint8_t b[KB];
+    for (uint64_t i = 0; i < blocks; i += KB / sizeof(Index)) {
+        uint64_t n = blocks - i < KB / sizeof(Index) ? blocks - i : KB / sizeof(Index);
+        packIndex(index + i, n, b);
+        if (!writeFully(file, b, n * sizeof(Index))) {
+            return false;
+        }
+    }
+    Trailer t = packTrailer(blocks);
+    return writeFully(file, &t, sizeof(Trailer));
+}
+
+// Read the index from the end of a file, leaving the file offset where it
+// was. Returns NULL if the file cannot seek or has no index.
+
+Index *readIndex(int file, uint64_t *blocks) {
+    off_t here = lseek(file, 0, SEEK_CUR);
+    off_t end = lseek(file, 0, SEEK_END);
+    if (here < 0 || end < 0) {
+        return NULL;
+    }
+    lseek(file, here, SEEK_SET);
+
+    Trailer t;
+    if (end < (off_t) sizeof(Trailer)
+        || !readAt(file, &t, sizeof(Trailer), end - sizeof(Trailer))) {
+        return NULL;
+    }
+    uint64_t n = isBig() ? swap64(t.blocks) : t.blocks;
+    if ((isBig() ? swap32(t.magic) : t.magic) != INDEX || n == 0
+        || n > (uint64_t) end / sizeof(Index)) {
+        return NULL;
+    }
+
+    Index *index = (Index *) malloc(n * sizeof(Index));
+    off_t start = end - sizeof(Trailer) - n * sizeof(Index);
+    if (!index || start < 0 || !readAt(file, index, n * sizeof(Index), start)) {
+        free(index);
+        return NULL;
+    }
+    for (uint64_t i = 0; i < n; i += 1) {
+        index[i].offset = isBig() ? swap64(index[i].offset) : index[i].offset;
+        index[i].position = isBig() ? swap64(index[i].position) : index[i].position;
+    }
+    *blocks = n;
+    return index;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "canon.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// A file of blocks starts with a Header whose magic is BLOCKS (and whose
+// file_size may be UNKNOWN if it was a stream), followed by blocks that are
+// coded independently of each other, each with its own code.
+// Every block starts with a Block that gives its sizes, and a Block with
+// raw equal to zero marks the end. Like the Header, it is little endian.
+
+typedef struct Block {
+    uint32_t raw; // Bytes of input in the block, zero for the end
+    uint32_t packed; // Bytes of coded block that follow
+} Block;
+
+// After the end of the blocks there may be an index that says where each
+// Block starts in the coded file and where its bytes go in the decoded file,
+// followed by a Trailer. Without an index the file simply ends with the
+// Block that marks the end, so its last bytes are zeros rather than INDEX.
+
+typedef struct Index {
+    uint64_t offset; // Where the Block starts in the coded file
+    uint64_t position; // Where its bytes start in the decoded file
+} Index;
+
+typedef struct Trailer {
+    uint64_t blocks; // Number of Index entries just before the Trailer
+    uint32_t reserved;
+    uint32_t magic; // INDEX
+} Trailer;
+
+#define INDEX 0xBEEF1DE5
+
+// The coded block starts with a byte saying how it was coded.
+
+#define STORED   0 // The bytes of the block as they are
+#define HUFFMAN  1 // Two bytes of length, code lengths (dumpLengths), code bits
+#define HUFFMAN4 2 // As HUFFMAN, but the code bits are in STREAMS streams, after
+                   // the sizes of all but the last (four bytes each)
+#define CONTEXT  3 // An order-1 code (see context.h): the number of clusters,
+                   // the cluster of each context (BYTE / 2 bytes, a nibble
+                   // each, low nibble first), then two bytes of length and the
+                   // code lengths of each cluster, then the code bits
+#define CONTEXT4 4 // As CONTEXT, but the code bits are in streams as for HUFFMAN4
+#define RUNS     5 // Four bytes giving the number of run-length coded bytes (see
+                   // runs.h), then a coded block of them
+#define SORTED   6 // Four bytes each of the primary index and the number of
+                   // ranks (see bwt.h), then a coded block of the ranks
+#define MATCHES  7 // Literals and matches (see lz77.h): two bytes of length and
+                   // the code lengths of the literal and length code, the same
+                   // for the distance code, then the code bits
+
+#define WIDE     8 // Four bytes of length, the code lengths of 16-bit symbols,
+                   // then the code bits of the symbols, each two bytes of the
+                   // block (little endian, the last padded with a zero byte if
+                   // the block is odd)
+
+#define MATCHBITS 15 // Longest code in a MATCHES block
+
+#define RLE   0x1 // Transforms that encodeBlock may try: run-length coding,
+#define BWT   0x2 // block sorting,
+#define WORDS 0x4 // and a code for 16-bit symbols rather than bytes
+
+#define STREAMS 4
+
+#define UNKNOWN       UINT64_MAX // file_size of a stream, whose size was not known
+#define MAXBLOCK      (1 << 30) // Largest block we are willing to handle
+#define BLOCKBOUND(n) ((n) + 3 + LENGTHS) // Room that encodeBlock needs for n bytes
+
+// Make sure that a buffer can hold n bytes.
+
+static inline bool grow(uint8_t **b, uint32_t *size, uint32_t n) {
+    if (n > *size) {
+        uint8_t *t = (uint8_t *) realloc(*b, n);
+        if (!t) {
+            return false;
+        }
+        *b = t;
+        *size = n;
+    }
+    return true;
+}
+
+extern uint32_t encodeBlock(const uint8_t *in, uint32_t n, uint8_t *out, uint32_t limit,
+                            uint32_t streams, uint32_t clusters, uint32_t transforms,
+                            uint32_t level, uint32_t window);
+
+extern bool decodeBlock(const uint8_t *in, uint32_t packed, uint8_t *out, uint32_t raw);
+
+extern void packIndex(const Index *index, uint64_t n, uint8_t *b);
+
+extern Trailer packTrailer(uint64_t blocks);
+
+extern bool writeIndex(int file, Index *index, uint64_t blocks);
+
+extern Index *readIndex(int file, uint64_t *blocks);
@@ -0,0 +1,328 @@
+#include "bwt.h"
+
+#include "sizes.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// SA-IS (Nong, Zhang and Chan) sorts the suffixes of s[0, n), whose last
+// symbol is a sentinel smaller than all the others, and whose symbols are no
+// larger than k. Each suffix is S-type if it is smaller than the one after
+// it and L-type otherwise; a leftmost S-type suffix (LMS) is S-type with an
+// L-type suffix before it. Once the LMS suffixes are in order, one pass
+// forward places the L-type suffixes and one pass back the S-type ones. The
+// LMS suffixes are put in order by sorting their LMS substrings this way,
+// naming them, and sorting the string of names, recursively if two of them
+// are the same.
+
+static inline bool isS(const uint8_t *t, int32_t i) {
+    return (t[i / 8] >> (i % 8)) & 0x1;
+}
+
+static inline void setType(uint8_t *t, int32_t i, bool s) {
+    t[i / 8] = s ? t[i / 8] | (0x1 << (i % 8)) : t[i / 8] & ~(0x1 << (i % 8));
+    return;
+}
+
+static inline bool isLMS(const uint8_t *t, int32_t i) {
+    return i > 0 && isS(t, i) && !isS(t, i - 1);
+}
+
+// The start (or the end) of the bucket of each symbol.
+
+static void buckets(const int32_t *s, int32_t *bkt, int32_t n, int32_t k, bool end) {
+    int32_t sum = 0;
+    memset(bkt, 0, (k + 1) * sizeof(int32_t));
+    for (int32_t i = 0; i < n; i += 1) {
+        bkt[s[i]] += 1;
+    }
+    for (int32_t i = 0; i <= k; i += 1) {
+        sum += bkt[i];
+        bkt[i] = end ? sum : sum - bkt[i];
+    }
+    return;
+}
+
+static void induce(const uint8_t *t, int32_t *sa, const int32_t *s, int32_t *bkt, int32_t n,
+                   int32_t k) {
+    buckets(s, bkt, n, k, false);
+    for (int32_t i = 0; i < n; i += 1) {
+        int32_t j = sa[i] - 1;
+        if (j >= 0 && !isS(t, j)) {
+            sa[bkt[s[j]]++] = j;
+        }
+    }
+    buckets(s, bkt, n, k, true);
+    for (int32_t i = n - 1; i >= 0; i -= 1) {
+        int32_t j = sa[i] - 1;
+        if (j >= 0 && isS(t, j)) {
+            sa[--bkt[s[j]]] = j;
+        }
+    }
+    return;
+}
+
+static bool sais(const int32_t *s, int32_t *sa, int32_t n, int32_t k) {
+    uint8_t *t = (uint8_t *) calloc(n / 8 + 1, 1);
+    int32_t *bkt = (int32_t *) malloc((k + 1) * sizeof(int32_t));
+    if (!t || !bkt) {
+        free(t);
+        free(bkt);
+        return false;
+    }
+
+    setType(t, n - 1, true); // The sentinel
+    for (int32_t i = n - 2; i >= 0; i -= 1) {
+        setType(t, i, s[i] < s[i + 1] || (s[i] == s[i + 1] && isS(t, i + 1)));
+    }
+
+    // Sort the LMS substrings.
+
+    buckets(s, bkt, n, k, true);
+    for (int32_t i = 0; i < n; i += 1) {
+        sa[i] = -1;
+    }
+    for (int32_t i = 1; i < n; i += 1) {
+        if (isLMS(t, i)) {
+            sa[--bkt[s[i]]] = i;
+        }
+    }
+    induce(t, sa, s, bkt, n, k);
+
+    // Name them in order, equal substrings alike. No two LMS positions are
+    // next to each other, so the name of the one at i can go in sa[n1 + i / 2].
+
+    int32_t n1 = 0;
+    for (int32_t i = 0; i < n; i += 1) {
+        if (isLMS(t, sa[i])) {
+            sa[n1++] = sa[i];
+        }
+    }
+    for (int32_t i = n1; i < n; i += 1) {
+        sa[i] = -1;
+    }
+    int32_t name = 0, prev = -1;
+    for (int32_t i = 0; i < n1; i += 1) {
+        int32_t pos = sa[i];
+        bool diff = false;
+        for (int32_t d = 0; d < n; d += 1) {
+            if (prev == -1 || s[pos + d] != s[prev + d] || isS(t, pos + d) != isS(t, prev + d)) {
+                diff = true;
+                break;
+            } else if (d > 0 && (isLMS(t, pos + d) || isLMS(t, prev + d))) {
+                break;
+            }
+        }
+        if (diff) {
+            name += 1;
+            prev = pos;
+        }
+        sa[n1 + pos / 2] = name - 1;
+    }
+    for (int32_t i = n - 1, j = n - 1; i >= n1; i -= 1) {
+        if (sa[i] >= 0) {
+            sa[j--] = sa[i];
+        }
+    }
+
+    // Sort the LMS suffixes by the string of names, which is at the end of sa.
+
+    int32_t *s1 = sa + n - n1;
+    if (name < n1) {
+        if (!sais(s1, sa, n1, name - 1)) {
+            free(t);
+            free(bkt);
+            return false;
+        }
+    } else {
+        for (int32_t i = 0; i < n1; i += 1) {
+            sa[s1[i]] = i;
+        }
+    }
+
+    // And from them the rest.
+
+    for (int32_t i = 1, j = 0; i < n; i += 1) {
+        if (isLMS(t, i)) {
+            s1[j++] = i;
+        }
+    }
+    for (int32_t i = 0; i < n1; i += 1) {
+        sa[i] = s1[sa[i]];
+    }
+    for (int32_t i = n1; i < n; i += 1) {
+        sa[i] = -1;
+    }
+    buckets(s, bkt, n, k, true);
+    for (int32_t i = n1 - 1; i >= 0; i -= 1) {
+        int32_t j = sa[i];
+        sa[i] = -1;
+        sa[--bkt[s[j]]] = j;
+    }
+    induce(t, sa, s, bkt, n, k);
+
+    free(t);
+    free(bkt);
+    return true;
+}
+
+// The bytes become the symbols 1 to BYTE, followed by the sentinel 0, which
+// plays the part of the end marker.
+
+bool sortBlock(const uint8_t *in, uint32_t n, uint8_t *out, uint32_t *primary) {
+    if (n > BWTMAX) {
+        return false;
+    } else if (n == 0) {
+        *primary = 0;
+        return true;
+    }
+    int32_t *s = (int32_t *) malloc((n + 1) * sizeof(int32_t));
+    int32_t *sa = (int32_t *) malloc((n + 1) * sizeof(int32_t));
+    bool ok = s && sa;
+    if (ok) {
+        for (uint32_t i = 0; i < n; i += 1) {
+            s[i] = in[i] + 1;
+        }
+        s[n] = 0;
+        ok = sais(s, sa, n + 1, BYTE);
+    }
+    for (uint32_t i = 0, o = 0; ok && i <= n; i += 1) {
+        if (sa[i] == 0) {
+            *primary = i;
+        } else {
+            out[o++] = in[sa[i] - 1];
+        }
+    }
+    free(s);
+    free(sa);
+    return ok;
+}
+
+// Row j of the sorted rotations starts with the byte f[j], and the same
+// occurrence of that byte ends row link[j], which therefore starts one
+// byte later in the block. The row that starts the block is primary, so
+// following the links from there spells out the block. Each entry holds the
+// link above the byte, so that it is the only memory touched for each byte.
+
+bool unsortBlock(const uint8_t *in, uint32_t n, uint32_t primary, uint8_t *out) {
+    if (n > BWTMAX || primary > n) {
+        return false;
+    }
+    uint32_t *link = (uint32_t *) malloc((n + 1) * sizeof(uint32_t));
+    if (!link) {
+        return false;
+    }
+
+    uint32_t start[BYTE] = { 0 };
+    for (uint32_t i = 0; i < n; i += 1) {
+        start[in[i]] += 1;
+    }
+    for (uint32_t c = 0, sum = 1; c < BYTE; c += 1) { // Row 0 starts with the end marker
+        uint32_t count = start[c];
+        start[c] = sum;
+        sum += count;
+    }
+    link[0] = 0; // Only reached after the last byte
+    for (uint32_t i = 0; i <= n; i += 1) {
+        if (i != primary) {
+            uint8_t c = in[i < primary ? i : i - 1];
+            link[start[c]++] = i << 8 | c;
+        }
+    }
+
+    uint32_t j = primary;
+    for (uint32_t i = 0; i < n; i += 1) {
+        out[i] = link[j] & 0xFF;
+        j = link[j] >> 8;
+    }
+    free(link);
+    return true;
+}
+
+// Write the digits of a run of k zeros.
+
+static uint32_t putRun(uint32_t k, uint8_t *out, uint32_t p) {
+    while (k > 0) {
+        if (k & 0x1) {
+            out[p++] = RUNA;
+            k = (k - 1) >> 1;
+        } else {
+            out[p++] = RUNB;
+            k = (k - 2) >> 1;
+        }
+    }
+    return p;
+}
+
+uint32_t packRanks(const uint8_t *in, uint32_t n, uint8_t *out) {
+    uint8_t list[BYTE];
+    for (uint32_t c = 0; c < BYTE; c += 1) {
+        list[c] = c;
+    }
+    uint32_t p = 0, zeros = 0;
+    for (uint32_t i = 0; i < n; i += 1) {
+        uint8_t b = in[i];
+        if (list[0] == b) {
+            zeros += 1;
+            continue;
+        }
+        p = putRun(zeros, out, p);
+        zeros = 0;
+        uint32_t r = 1;
+        while (list[r] != b) {
+            r += 1;
+        }
+        memmove(list + 1, list, r);
+        list[0] = b;
+        if (r < ESCAPE - 1) {
+            out[p++] = r + 1;
+        } else {
+            out[p++] = ESCAPE;
+            out[p++] = r;
+        }
+    }
+    return putRun(zeros, out, p);
+}
+
+bool unpackRanks(const uint8_t *in, uint32_t m, uint8_t *out, uint32_t n) {
+    uint8_t list[BYTE];
+    for (uint32_t c = 0; c < BYTE; c += 1) {
+        list[c] = c;
+    }
+    uint32_t i = 0, o = 0;
+    while (i < m) {
+        uint8_t b = in[i++];
+        if (b <= RUNB) { // A run of the front byte, its digits
+            uint64_t k = 0, digit = 1;
+            i -= 1;
+            while (i < m && in[i] <= RUNB && k <= n) {
+                k += digit << in[i];
+                digit <<= 1;
+                i += 1;
+            }
+            if (k > n - o) {
+                return false;
+            }
+            memset(out + o, list[0], k);
+            o += k;
+            continue;
+        }
+        uint32_t r = b - 1;
+        if (b == ESCAPE) {
+            if (i == m || in[i] < ESCAPE - 1) {
+                return false;
+            }
+            r = in[i++];
+        }
+        if (o == n) {
+            return false;
+        }
+        uint8_t c = list[r];
+        memmove(list + 1, list, r);
+        list[0] = c;
+        out[o++] = c;
+    }
+    return o == n;
+}
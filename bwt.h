@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Block sorting, as in bzip2: the Burrows-Wheeler transform gathers bytes
+// that are followed by the same text, so that the bytes of the transformed
+// block tend to repeat the few bytes just before them. Move-to-front turns
+// those into small ranks, mostly zero, and the runs of zeros are counted.
+// What is left is much easier for a Huffman code than the block was.
+//
+// The transform is the last column of the sorted rotations of the block and
+// an end marker; the marker itself is left out, and primary says where it
+// was. The rotations are sorted with a suffix array, built in linear time by
+// induced sorting (SA-IS). The inverse follows a single table of links in
+// which each entry also holds its byte, so each byte costs one cache miss
+// rather than two. That table limits a sorted block to BWTMAX bytes.
+
+#define BWTMAX ((1 << 24) - 1)
+
+// Sort the n bytes of in into out, returning false if n is too big or memory
+// runs out.
+
+extern bool sortBlock(const uint8_t *in, uint32_t n, uint8_t *out, uint32_t *primary);
+
+extern bool unsortBlock(const uint8_t *in, uint32_t n, uint32_t primary, uint8_t *out);
+
+// The ranks are coded in the byte alphabet: RUNA and RUNB are the digits of
+// the length of a run of zeros (bijective base 2, the low digit first), a
+// rank from 1 to 253 is one more than itself, and a larger rank is ESCAPE
+// followed by the rank.
+
+#define RUNA   0
+#define RUNB   1
+#define ESCAPE 255
+
+#define RANKSBOUND(n) (2 * (n) + 1) // Most bytes that packRanks makes of n
+
+// Move-to-front code n bytes and count the runs of zeros into out, returning
+// how many bytes it took.
+
+extern uint32_t packRanks(const uint8_t *in, uint32_t n, uint8_t *out);
+
+// Undo packRanks, returning false unless the m bytes at in make exactly n
+// bytes.
+
+extern bool unpackRanks(const uint8_t *in, uint32_t m, uint8_t *out, uint32_t n);
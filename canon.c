@@ -0,0 +1,452 @@
+#include "canon.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// The length of each code is the depth of its leaf.
+
+static void lengthsFrom(const tree *t, uint32_t i, uint8_t depth, uint8_t l[]) {
+    const treeNode *n = &t->nodes[i];
+    if (n->leaf) {
+        l[n->symbol] = depth;
+    } else {
+        lengthsFrom(t, n->left, depth + 1, l);
+        lengthsFrom(t, n->right, depth + 1, l);
+    }
+    return;
+}
+
+void codeLengths(const tree *t, uint8_t l[]) {
+    if (t && t->count) {
+        lengthsFrom(t, t->root, 0, l);
+    }
+    return;
+}
+
+// Add one to a code, treating its first bit as the most significant. It
+// fails if the code is all ones, which means the lengths asked for more
+// codes than there are.
+
+static bool increment(code *c) {
+    for (uint32_t i = c->l; i > 0; i -= 1) {
+        uint8_t mask = 0x1 << ((i - 1) % 8);
+        if (c->bits[(i - 1) / 8] & mask) {
+            c->bits[(i - 1) / 8] &= ~mask; // Carry
+        } else {
+            c->bits[(i - 1) / 8] |= mask;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Each code is the previous code plus one, extended with zeros to its own
+// length. Symbols with length zero get an empty code.
+
+bool canonicalCodes(uint8_t l[], uint32_t symbols, code c[]) {
+    uint32_t longest = 0;
+    for (uint32_t s = 0; s < symbols; s += 1) {
+        c[s] = newCode();
+        longest = l[s] > longest ? l[s] : longest;
+    }
+
+    code next = newCode();
+    bool first = true;
+
+    for (uint32_t length = 1; length <= longest; length += 1) {
+        for (uint32_t s = 0; s < symbols; s += 1) {
+            if (l[s] == length) {
+                if (!first && !increment(&next)) {
+                    return false;
+                }
+                while (next.l < length) {
+                    pushCode(&next, 0);
+                }
+                c[s] = next;
+                first = false;
+            }
+        }
+    }
+    return true;
+}
+
+// The lengths of the codes for symbols [0, symbols) are saved as:
+//   1. One byte giving the width of each length, 4 or 8 bits, plus LIST if
+//      the symbols are listed rather than given as a bitmap, or RANGES if
+//      they are given as ranges
+//   2. A bitmap of the symbols that have a code (one bit for each symbol,
+//      rounded up to bytes), or, whichever is shortest:
+//        - for an alphabet of bytes, the number of such symbols less one
+//          followed by the symbols
+//        - for a larger alphabet, the number of ranges of such symbols and
+//          for each of them the number of symbols without a code before it
+//          and the number in it less one, each seven bits at a time with
+//          the low bits first and the top bit of a byte set if more follow
+//   3. The lengths of those symbols in order, packed two to a byte if the
+//      width is 4 (low nibble first)
+
+#define LIST   0x10
+#define RANGES 0x20
+
+static uint32_t putNumber(uint8_t b[], uint32_t p, uint32_t x) {
+    do {
+        if (b) {
+            b[p] = (x & 0x7F) | (x > 0x7F ? 0x80 : 0);
+        }
+        p += 1;
+        x >>= 7;
+    } while (x > 0);
+    return p;
+}
+
+static bool getNumber(const uint8_t b[], uint32_t bytes, uint32_t *p, uint32_t *x) {
+    *x = 0;
+    for (uint32_t shift = 0; shift < 32; shift += 7) {
+        if (*p == bytes) {
+            return false;
+        }
+        uint8_t c = b[(*p)++];
+        *x |= (uint32_t) (c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Save the ranges of symbols with a code at b + p (or only count the bytes
+// if b is NULL), returning where they end.
+
+static uint32_t putRanges(uint8_t l[], uint32_t symbols, uint8_t b[], uint32_t p) {
+    uint32_t n = 0;
+    for (uint32_t s = 0; s < symbols; s += 1) {
+        n += l[s] && (s == 0 || !l[s - 1]);
+    }
+    p = putNumber(b, p, n);
+    for (uint32_t s = 0, end = 0; s < symbols; s += 1) {
+        if (l[s] && (s == 0 || !l[s - 1])) {
+            uint32_t e = s;
+            while (e < symbols && l[e]) {
+                e += 1;
+            }
+            p = putNumber(b, p, s - end);
+            p = putNumber(b, p, e - s - 1);
+            end = e;
+        }
+    }
+    return p;
+}
+
+uint32_t dumpLengths(uint8_t l[], uint32_t symbols, uint8_t b[]) {
+    uint8_t width = 4;
+    uint32_t n = 0, map = (symbols + 7) / 8;
+    for (uint32_t s = 0; s < symbols; s += 1) {
+        width = l[s] > 15 ? 8 : width;
+        n += l[s] > 0;
+    }
+
+    uint32_t p = 1;
+    if (symbols <= BYTE && n > 0 && 1 + n < map) {
+        b[0] = width | LIST;
+        b[p++] = n - 1;
+        for (uint32_t s = 0; s < symbols; s += 1) {
+            if (l[s]) {
+                b[p++] = s;
+            }
+        }
+    } else if (symbols > BYTE && putRanges(l, symbols, NULL, 0) < map) {
+        b[0] = width | RANGES;
+        p = putRanges(l, symbols, b, p);
+    } else {
+        b[0] = width;
+        for (uint32_t i = 0; i < map; i += 1) {
+            b[p++] = 0;
+        }
+        for (uint32_t s = 0; s < symbols; s += 1) {
+            b[1 + s / 8] |= (l[s] > 0) << (s % 8);
+        }
+    }
+
+    uint32_t k = 0;
+    for (uint32_t s = 0; s < symbols; s += 1) {
+        if (l[s]) {
+            if (width == 8) {
+                b[p++] = l[s];
+            } else if (k % 2 == 0) {
+                b[p] = l[s];
+            } else {
+                b[p++] |= l[s] << 4;
+            }
+            k += 1;
+        }
+    }
+    return width == 4 && k % 2 ? p + 1 : p;
+}
+
+// The k-th saved length, for the k-th symbol that has a code.
+
+static inline uint8_t savedLength(const uint8_t b[], uint8_t width, uint32_t k) {
+    return width == 8 ? b[k] : (b[k / 2] >> (4 * (k % 2))) & 0xF;
+}
+
+bool loadLengths(const uint8_t b[], uint32_t bytes, uint32_t symbols, uint8_t l[]) {
+    if (bytes < 2 || ((b[0] & ~(LIST | RANGES)) != 4 && (b[0] & ~(LIST | RANGES)) != 8)
+        || (b[0] & LIST && b[0] & RANGES)) {
+        return false;
+    }
+    uint8_t width = b[0] & ~(LIST | RANGES);
+
+    for (uint32_t s = 0; s < symbols; s += 1) {
+        l[s] = 0;
+    }
+
+    uint32_t n = 0, p = 1, map = (symbols + 7) / 8;
+    if (b[0] & LIST) {
+        n = b[p++] + 1;
+        if (symbols > BYTE || bytes != p + n + (width == 4 ? (n + 1) / 2 : n)) {
+            return false;
+        }
+        for (uint32_t k = 0; k < n; k += 1) {
+            uint8_t length = savedLength(b + p + n, width, k);
+            if (length == 0 || b[p + k] >= symbols || l[b[p + k]] != 0) {
+                return false; // Every listed symbol needs a code, and only one
+            }
+            l[b[p + k]] = length;
+        }
+        return true;
+    }
+
+    if (b[0] & RANGES) {
+
+        // Mark the symbols of the ranges, and then find their lengths.
+
+        uint32_t ranges;
+        if (!getNumber(b, bytes, &p, &ranges)) {
+            return false;
+        }
+        for (uint32_t r = 0, end = 0; r < ranges; r += 1) {
+            uint32_t gap, size;
+            if (!getNumber(b, bytes, &p, &gap) || !getNumber(b, bytes, &p, &size)
+                || gap > symbols - end || size >= symbols - end - gap) {
+                return false;
+            }
+            end += gap;
+            for (uint32_t s = end; s <= end + size; s += 1) {
+                l[s] = 1;
+            }
+            end += size + 1;
+            n += size + 1;
+        }
+    } else {
+        if (bytes < 1 + map) {
+            return false;
+        }
+        for (uint32_t s = 0; s < symbols; s += 1) {
+            l[s] = (b[1 + s / 8] >> (s % 8)) & 0x1;
+            n += l[s];
+        }
+        p += map;
+    }
+
+    if (bytes != p + (width == 4 ? (n + 1) / 2 : n)) {
+        return false;
+    }
+    for (uint32_t s = 0, k = 0; s < symbols; s += 1) {
+        if (l[s]) {
+            l[s] = savedLength(b + p, width, k);
+            if (l[s] == 0) {
+                return false; // Every listed symbol needs a code
+            }
+            k += 1;
+        }
+    }
+    return true;
+}
+
+// Package-merge finds the optimal code lengths that do not exceed limit.
+// Think of each symbol as a coin worth 2^-limit, 2^-(limit - 1), ..., 1/2
+// units with a numismatic value of its count. We need to buy 1 unit of
+// coverage as cheaply as possible: at each denomination, starting from the
+// smallest, pair up the cheapest items into packages and merge them with the
+// coins of the next denomination. The first 2(n - 1) items of the final list
+// are the ones we buy, and the length of each code is the number of its
+// coins among them.
+//
+// Packages are formed from consecutive items, so buying k packages at one
+// level means buying the first 2k items of the level below. We only have to
+// remember which items are coins and which are packages.
+
+#define PACKAGE UINT32_MAX
+
+typedef struct coin {
+    uint64_t weight;
+    uint32_t symbol; // The symbol of a coin, or PACKAGE
+} coin;
+
+static int cheaper(const void *a, const void *b) {
+    const coin *x = (const coin *) a, *y = (const coin *) b;
+    if (x->weight != y->weight) {
+        return x->weight < y->weight ? -1 : 1;
+    }
+    return x->symbol < y->symbol ? -1 : x->symbol > y->symbol;
+}
+
+bool limitLengths(uint64_t hist[], uint8_t l[], uint32_t symbols, uint32_t limit) {
+    uint32_t n = 0, longest = 0;
+    for (uint32_t s = 0; s < symbols; s += 1) {
+        n += l[s] > 0;
+        longest = l[s] > longest ? l[s] : longest;
+    }
+    if (longest <= limit) {
+        return true; // Huffman's code is already within the limit
+    }
+    while (limit < MAXLIMIT && (1u << limit) < n) {
+        limit += 1; // Need at least log2(n) bits to tell the symbols apart
+    }
+
+    coin *leaves = (coin *) calloc(n, sizeof(coin));
+    coin *level = (coin *) calloc((size_t) limit * 2 * n, sizeof(coin));
+    uint32_t *size = (uint32_t *) calloc(limit, sizeof(uint32_t));
+    if (!leaves || !level || !size) {
+        free(leaves);
+        free(level);
+        free(size);
+        return false;
+    }
+
+    // The coins in order of increasing count, and of symbol within a count.
+
+    uint32_t k = 0;
+    for (uint32_t s = 0; s < symbols; s += 1) {
+        if (l[s]) {
+            leaves[k++] = (coin) { .weight = hist[s], .symbol = s };
+        }
+    }
+    qsort(leaves, n, sizeof(coin), cheaper);
+
+    // Level 0 holds the smallest denomination and has only coins; every
+    // other level merges the coins with the packages of the level below.
+
+    for (uint32_t i = 0; i < n; i += 1) {
+        level[i] = leaves[i];
+    }
+    size[0] = n;
+    for (uint32_t j = 1; j < limit; j += 1) {
+        coin *below = level + (size_t) (j - 1) * 2 * n, *here = level + (size_t) j * 2 * n;
+        uint32_t c = 0, p = 0, m = 0;
+        while (c < n || p + 1 < size[j - 1]) {
+            uint64_t package = p + 1 < size[j - 1] ? below[p].weight + below[p + 1].weight : 0;
+            if (c < n && (p + 1 >= size[j - 1] || leaves[c].weight <= package)) {
+                here[m++] = leaves[c++];
+            } else {
+                here[m++] = (coin) { .weight = package, .symbol = PACKAGE };
+                p += 2;
+            }
+        }
+        size[j] = m;
+    }
+
+    // Buy the first 2(n - 1) items of the top level and work back down.
+
+    for (uint32_t s = 0; s < symbols; s += 1) {
+        l[s] = 0;
+    }
+    uint32_t buy = 2 * (n - 1);
+    for (uint32_t j = limit; j > 0 && buy > 0; j -= 1) {
+        coin *here = level + (size_t) (j - 1) * 2 * n;
+        uint32_t packages = 0;
+        for (uint32_t i = 0; i < buy; i += 1) {
+            if (here[i].symbol == PACKAGE) {
+                packages += 1;
+            } else {
+                l[here[i].symbol] += 1;
+            }
+        }
+        buy = 2 * packages;
+    }
+
+    free(leaves);
+    free(level);
+    free(size);
+    return true;
+}
+
+// Moffat and Katajainen's in-place method finds the lengths of a Huffman code
+// without building a tree. With the weights in increasing order, the first
+// pass combines them as Huffman's method does, where the next smallest item
+// is either the next leaf or the oldest unpaired interior node, leaving
+// interior nodes in the array, each pointing to its parent. The second pass
+// turns parent pointers into depths, from the root down, and the third hands
+// out leaf depths, deepest to the smallest weights. Sorting is the only part
+// that is not linear, and nothing is allocated but the one array.
+
+bool huffmanLengths(const uint64_t hist[], uint32_t symbols, uint8_t l[]) {
+    uint32_t n = 0;
+    for (uint32_t s = 0; s < symbols; s += 1) {
+        l[s] = 0;
+        n += hist[s] > 0;
+    }
+    if (n < 2) { // A code needs two symbols, so stand-ins as huffmanTree makes them
+        uint32_t s = 0;
+        while (s < symbols && !hist[s]) {
+            s += 1;
+        }
+        l[s < symbols ? s : 0] = 1;
+        l[s == 0 ? symbols - 1 : 0] = 1;
+        return true;
+    }
+
+    coin *a = (coin *) malloc(n * sizeof(coin));
+    if (!a) {
+        return false;
+    }
+    for (uint32_t s = 0, k = 0; s < symbols; s += 1) {
+        if (hist[s]) {
+            a[k++] = (coin) { .weight = hist[s], .symbol = s };
+        }
+    }
+    qsort(a, n, sizeof(coin), cheaper);
+
+    uint32_t root = 0, leaf = 2;
+    a[0].weight += a[1].weight;
+    for (uint32_t next = 1; next < n - 1; next += 1) {
+        if (leaf >= n || a[root].weight < a[leaf].weight) {
+            a[next].weight = a[root].weight;
+            a[root++].weight = next;
+        } else {
+            a[next].weight = a[leaf++].weight;
+        }
+        if (leaf >= n || (root < next && a[root].weight < a[leaf].weight)) {
+            a[next].weight += a[root].weight;
+            a[root++].weight = next;
+        } else {
+            a[next].weight += a[leaf++].weight;
+        }
+    }
+
+    a[n - 2].weight = 0;
+    for (uint32_t next = n - 2; next-- > 0;) {
+        a[next].weight = a[a[next].weight].weight + 1;
+    }
+
+    int64_t internal = (int64_t) n - 2, next = n - 1;
+    for (uint32_t available = 1, depth = 0; available > 0; depth += 1) {
+        uint32_t used = 0;
+        while (internal >= 0 && a[internal].weight == depth) {
+            used += 1;
+            internal -= 1;
+        }
+        while (available > used) {
+            a[next--].weight = depth;
+            available -= 1;
+        }
+        available = 2 * used;
+    }
+
+    for (uint32_t k = 0; k < n; k += 1) {
+        l[a[k].symbol] = a[k].weight;
+    }
+    free(a);
+    return true;
+}
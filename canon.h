@@ -0,0 +1,35 @@
+#pragma once
+
+#include "code.h"
+#include "huffman.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Canonical Huffman codes are completely determined by their lengths, so
+// that is all we need to save: the codes are handed out in order of length,
+// and within a length in order of symbol.
+
+#define LENGTHSOF(n) (1 + ((n) + 7) / 8 + (n)) // Most bytes that dumpLengths produces for n symbols
+#define LENGTHS      LENGTHSOF(BYTE)
+
+// A limit on code lengths must leave room for every byte, and limitLengths
+// raises a smaller one for larger alphabets (16-bit symbols) to what they need.
+
+#define MINLIMIT 8
+#define MAXLIMIT 32
+
+extern void codeLengths(const tree *t, uint8_t l[]);
+
+// The lengths of a Huffman code for the symbols that occur in hist, found
+// without building a tree (as huffmanTree and codeLengths would).
+
+extern bool huffmanLengths(const uint64_t hist[], uint32_t symbols, uint8_t l[]);
+
+extern bool limitLengths(uint64_t hist[], uint8_t l[], uint32_t symbols, uint32_t limit);
+
+extern bool canonicalCodes(uint8_t l[], uint32_t symbols, code c[]);
+
+extern uint32_t dumpLengths(uint8_t l[], uint32_t symbols, uint8_t b[]);
+
+extern bool loadLengths(const uint8_t b[], uint32_t bytes, uint32_t symbols, uint8_t l[]);
@@ -4,7 +4,6 @@
 
 #include <stdbool.h>
 #include <stdint.h>
-#include <unistd.h>
 
 typedef struct code {
     uint8_t bits[CODE / 8];
@@ -54,42 +53,31 @@ static inline bool fullCode(code *c) {
     return c->l == CODE;
 }
 
-// State for writing the code to a file efficiently. codeB is a buffer of bits
-// to be written. codeP is a pointer to the end of the buffer, and codeC is a
-// count of the total number of code bits.
+// Extract n bits of a code starting at bit s, first bit in bit 0.
 
-static uint8_t codeB[KB];
-static uint32_t codeP = 0;
-static uint64_t codeC = 0;
-
-// flushCode will write any code bytes that have not already been written.
-
-static inline void flushCode(int file) {
-    if (codeP) {
-        write(file, codeB, codeP % 8 ? codeP / 8 + 1 : codeP / 8);
+static inline uint64_t codeBits(code *c, uint32_t s, uint32_t n) {
+    uint64_t v = 0;
+    for (uint32_t i = 0; i < n; i += 1) {
+        v |= (uint64_t) ((c->bits[(s + i) / 8] >> ((s + i) % 8)) & 0x1) << i;
     }
-    return;
+    return v;
 }
 
-// appendCode is a bit tricky: append the bits from codes into a buffer. If
-// the buffer fills, then write it and continue appending code bits (if there
-// are any left in the current code).
+// A code that fits in a machine word, first bit in bit 0, so that it can be
+// appended to the output with a single shift. Codes longer than 64 bits need
+// more than a terabyte of very skewed input; they are left with l = 0 and
+// appended from the full code instead.
 
-static inline void appendCode(int file, code c) {
-    codeC += c.l;
-    for (uint32_t i = 0; i < c.l; i += 1) {
-        if (c.bits[i / 8] & (0x1 << (i % 8))) // Bit set?
-        {
-            codeB[codeP / 8] |= (0x1 << (codeP % 8)); // Append 1
-        } else {
-            codeB[codeP / 8] &= ~(0x1 << (codeP % 8)); // Append 0
-        }
+typedef struct wordCode {
+    uint64_t bits;
+    uint32_t l;
+} wordCode;
 
-        codeP += 1;
-        if (codeP == KB * 8) { // Flush if the buffer is full
-            write(file, codeB, KB);
-            codeP = 0;
-        }
+static inline wordCode toWord(code c) {
+    wordCode w = { 0, 0 };
+    if (c.l <= 64) {
+        w.bits = codeBits(&c, 0, c.l);
+        w.l = c.l;
     }
-    return;
+    return w;
 }
@@ -0,0 +1,225 @@
+#include "context.h"
+
+#include "canon.h"
+#include "huffman.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS 3 // Rounds of reassigning contexts for each number of clusters
+
+void countPairs(const uint8_t *b, size_t n, uint32_t pairs[BYTE][BYTE]) {
+    uint8_t last = 0;
+    for (size_t i = 0; i < n; i += 1) {
+        pairs[last][b[i]] += 1;
+        last = b[i];
+    }
+    return;
+}
+
+// Building a Huffman code for every cluster at every step would take far
+// longer than coding the block, so while the clusters are being found each
+// byte is charged what an ideal code for its cluster would charge, -log2 of
+// its probability there. A byte that its cluster lacks is charged as if it
+// had occurred half a time. Only the clusters that are chosen get real codes.
+
+// The bytes that follow a context, as a list, since most contexts are
+// followed by only a few different bytes.
+
+typedef struct follower {
+    uint32_t count;
+    uint8_t symbol;
+} follower;
+
+typedef struct clustering {
+    uint8_t used[BYTE]; // The contexts that occur
+    uint32_t contexts;
+    follower *list[BYTE]; // The bytes that follow each of them
+    uint32_t followers[BYTE];
+    uint8_t map[BYTE]; // The cluster of each context
+    uint64_t hist[CLUSTERS][BYTE]; // The bytes that follow the contexts of each cluster
+    double bits[CLUSTERS][BYTE]; // What each byte costs in each cluster
+} clustering;
+
+// Bits for the bytes that follow context x when charged bits.
+
+static double cost(clustering *c, uint32_t x, const double bits[BYTE]) {
+    double total = 0;
+    for (uint32_t i = 0; i < c->followers[x]; i += 1) {
+        total += c->list[x][i].count * bits[c->list[x][i].symbol];
+    }
+    return total;
+}
+
+// Charge for bytes by how often they occur in hist.
+
+static void charge(const uint64_t hist[BYTE], double bits[BYTE]) {
+    uint64_t n = 0;
+    for (uint32_t s = 0; s < BYTE; s += 1) {
+        n += hist[s];
+    }
+    double all = log2((double) n + 1);
+    for (uint32_t s = 0; s < BYTE; s += 1) {
+        bits[s] = all - log2(hist[s] ? (double) hist[s] : 0.5);
+    }
+    return;
+}
+
+// The histogram and charges of each of k clusters from the contexts that
+// map to it.
+
+static void gather(clustering *c, uint32_t k) {
+    memset(c->hist, 0, sizeof(c->hist));
+    for (uint32_t i = 0; i < c->contexts; i += 1) {
+        uint8_t x = c->used[i];
+        for (uint32_t j = 0; j < c->followers[x]; j += 1) {
+            c->hist[c->map[x]][c->list[x][j].symbol] += c->list[x][j].count;
+        }
+    }
+    for (uint32_t j = 0; j < k; j += 1) {
+        charge(c->hist[j], c->bits[j]);
+    }
+    return;
+}
+
+// Move every context to the cluster that charges it least.
+
+static void reassign(clustering *c, uint32_t k) {
+    for (uint32_t i = 0; i < c->contexts; i += 1) {
+        uint8_t x = c->used[i];
+        double least = HUGE_VAL;
+        for (uint32_t j = 0; j < k; j += 1) {
+            double bits = cost(c, x, c->bits[j]);
+            if (bits < least) {
+                least = bits;
+                c->map[x] = j;
+            }
+        }
+    }
+    return;
+}
+
+// Renumber the clusters that are in use in order of their first context,
+// returning how many there are, and estimate the bits it takes to code the
+// bytes with them and to save them (about four bits for each code length).
+
+static uint32_t compact(clustering *c, double *bits) {
+    uint8_t renumber[CLUSTERS];
+    memset(renumber, 0xFF, sizeof(renumber));
+    uint32_t n = 0;
+    double total = 0;
+    for (uint32_t i = 0; i < c->contexts; i += 1) {
+        uint8_t x = c->used[i];
+        if (renumber[c->map[x]] == 0xFF) {
+            renumber[c->map[x]] = n;
+            n += 1;
+        }
+        total += cost(c, x, c->bits[c->map[x]]);
+    }
+    for (uint32_t x = 0; x < BYTE; x += 1) {
+        c->map[x] = renumber[c->map[x]] == 0xFF ? 0 : renumber[c->map[x]]; // Unused contexts
+    }
+    gather(c, n);
+    for (uint32_t j = 0; j < n; j += 1) {
+        uint32_t symbols = 0;
+        for (uint32_t s = 0; s < BYTE; s += 1) {
+            symbols += c->hist[j][s] > 0;
+        }
+        total += 8 * (3 + BYTE / 8) + 4 * symbols;
+    }
+    *bits = total + (n > 1 ? 8 * (1 + BYTE / 2) : 0);
+    return n;
+}
+
+// Clusters are added one at a time, each seeded with the context that its
+// current cluster suits worst (compared with a code of its own), and then
+// refined by a few rounds of k-means: gather the bytes of each cluster from
+// its contexts, and move each context to the cluster that charges it least.
+// We stop once more clusters no longer pay for themselves.
+
+uint32_t clusterContexts(uint32_t pairs[BYTE][BYTE], uint32_t most, uint32_t limit,
+                         uint8_t map[BYTE], uint8_t lengths[][BYTE]) {
+    most = most < 1 ? 1 : (most > CLUSTERS ? CLUSTERS : most);
+    clustering *c = (clustering *) calloc(1, sizeof(clustering));
+    follower *all = (follower *) malloc(BYTE * BYTE * sizeof(follower));
+    if (!c || !all) {
+        free(c);
+        free(all);
+        return 0;
+    }
+
+    double own[BYTE] = { 0 };
+    for (uint32_t x = 0; x < BYTE; x += 1) {
+        c->list[x] = all + x * BYTE;
+        uint64_t hist[BYTE] = { 0 };
+        for (uint32_t s = 0; s < BYTE; s += 1) {
+            if (pairs[x][s]) {
+                c->list[x][c->followers[x]++] = (follower) { .count = pairs[x][s], .symbol = s };
+                hist[s] = pairs[x][s];
+            }
+        }
+        if (c->followers[x]) {
+            double bits[BYTE];
+            charge(hist, bits);
+            c->used[c->contexts++] = x;
+            own[x] = cost(c, x, bits);
+        }
+    }
+
+    uint32_t best = 0, worse = 0;
+    double fewest = HUGE_VAL;
+    uint8_t bestMap[BYTE] = { 0 };
+    gather(c, 1);
+    for (uint32_t k = 1; k <= most && worse < 2; k += 1) {
+        if (k > 1) { // Seed the new cluster
+            double excess = 0;
+            uint32_t seed = BYTE;
+            for (uint32_t i = 0; i < c->contexts; i += 1) {
+                uint8_t x = c->used[i];
+                double bits = cost(c, x, c->bits[c->map[x]]) - own[x];
+                if (bits > excess) {
+                    excess = bits;
+                    seed = x;
+                }
+            }
+            if (seed == BYTE) {
+                break; // Every context already has a code as good as its own
+            }
+            c->map[seed] = k - 1;
+            for (uint32_t round = 0; round < ROUNDS; round += 1) {
+                gather(c, k);
+                reassign(c, k);
+            }
+            gather(c, k);
+        }
+
+        double bits;
+        k = compact(c, &bits);
+        if (bits < fewest) {
+            fewest = bits;
+            best = k;
+            memcpy(bestMap, c->map, BYTE);
+            worse = 0;
+        } else {
+            worse += 1;
+        }
+    }
+
+    // Real codes for the clusters that were chosen.
+
+    bool ok = true;
+    memcpy(c->map, bestMap, BYTE);
+    memcpy(map, bestMap, BYTE);
+    gather(c, best);
+    for (uint32_t j = 0; j < best && ok; j += 1) {
+        ok = huffmanLengths(c->hist[j], BYTE, lengths[j])
+             && (!limit || limitLengths(c->hist[j], lengths[j], BYTE, limit));
+    }
+
+    free(all);
+    free(c);
+    return ok ? best : 0;
+}
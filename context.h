@@ -0,0 +1,28 @@
+#pragma once
+
+#include "sizes.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// An order-1 code picks the code for each byte by the byte before it (its
+// context; the first byte of a stream has context 0). A code for every one of
+// the BYTE contexts would cost more to save than it gains on all but huge
+// blocks, so similar contexts are clustered and share a code: map gives the
+// cluster of each context, and there are at most CLUSTERS of them.
+
+#define CLUSTERS 16
+
+// Add the number of times each byte follows each other byte in b[0, n) to
+// pairs[context][byte], starting with context 0.
+
+extern void countPairs(const uint8_t *b, size_t n, uint32_t pairs[BYTE][BYTE]);
+
+// Cluster the contexts into at most most clusters, choosing the number that
+// gives the fewest bits in all (counting the code lengths that have to be
+// saved), and find the code lengths of each cluster (none longer than limit
+// bits, unless limit is zero). Returns the number of clusters, or zero if
+// memory ran out.
+
+extern uint32_t clusterContexts(uint32_t pairs[BYTE][BYTE], uint32_t most, uint32_t limit,
+                                uint8_t map[BYTE], uint8_t lengths[][BYTE]);
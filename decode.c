@@ -1,16 +1,31 @@
+#include "adaptive.h"
+#include "batch.h"
+#include "block.h"
+#include "canon.h"
 #include "code.h"
+#include "dictionary.h"
 #include "endian.h"
+#include "flow.h"
 #include "header.h"
 #include "huffman.h"
+#include "io.h"
+#include "map.h"
+#include "pool.h"
 #include "queue.h"
+#include "seek.h"
 #include "sizes.h"
 #include "stack.h"
+#include "table.h"
 
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -34,110 +49,693 @@ static inline char *strdup_fallback(const char *s) {
 
 static int verbose = false;
 static int print = false;
-
-static treeNode *loadTree(uint8_t savedTree[], uint16_t treeBytes) {
+static int walk = false;
+static uint32_t threads = 0;
+static bool ranged = false;
+static uint64_t rangeOffset = 0, rangeLength = UINT64_MAX;
+static char *tables = NULL; // Where saved tables are (-d)
+
+// loadTree rebuilds a post-order tree. Each node takes at least one byte of
+// it, so treeBytes nodes are always enough. Returns NULL if the tree makes
+// no sense (or there is no memory for it), without stopping, since a batch
+// goes on to the next file.
+
+static tree *loadTree(const uint8_t savedTree[], uint16_t treeBytes) {
     uint32_t count = 0;
+    tree *t = newTree(treeBytes);
     stack *s = newStack();
+    bool ok = t && s;
 
-    while (count < treeBytes) {
+    while (ok && count < treeBytes) {
         if (savedTree[count] == 'L') {
             count += 1;
-            treeNode *t = newNode(savedTree[count], true, 1);
-            push(s, t);
+            ok = count < treeBytes; // The symbol follows
+            if (ok) {
+                push(s, newNode(t, savedTree[count], true, 1));
+            }
         } else {
-            treeNode *a = NULL, *b = NULL;
-
-            if (emptyS(s)) // Right node
-            {
-                ERROR("Incorrect tree");
-            } else {
-                b = pop(s);
+            treeNode *b = pop(s); // Right node
+            treeNode *a = pop(s); // Left node
+            ok = a && b;
+            if (ok) {
+                push(s, join(t, a, b));
             }
+        }
+        count += 1;
+    }
 
-            if (emptyS(s)) // Left node
-            {
-                ERROR("Incorrect tree");
-            } else {
-                a = pop(s);
-            }
+    treeNode *root = ok ? pop(s) : NULL;
+    if (s) {
+        delStack(s);
+    }
+    if (!root) {
+        delTree(t);
+        return NULL;
+    }
+    t->root = root - t->nodes;
+    return t;
+}
+
+// walkTree decodes up to n symbols into out by following the flattened tree
+// one bit at a time, taking the first entry of a node on 0 and the second on
+// 1, and going back to the root after each leaf. It stops early if the input
+// runs out.
+
+static uint64_t walkTree(const uint16_t *flat, bitReader *r, uint8_t *out, uint64_t n) {
+    uint64_t i = 0;
+    uint32_t node = 0;
 
-            push(s, join(a, b));
+    while (flat && i < n) {
+        uint32_t b = peekBits(r, 1);
+        skipBits(r, 1);
+        if (exhausted(r)) {
+            break;
+        }
+        uint16_t e = flat[2 * node + b];
+        if (e & FLATLEAF) { // Emit symbol when leaf is reached, reset to root.
+            out[i] = e & ~FLATLEAF;
+            i += 1;
+            node = 0;
+        } else {
+            node = e;
         }
-        count += 1;
     }
+    return i;
+}
+
+// lookUp produces the same output as walkTree, but resolves a whole symbol
+// with each table lookup rather than following one entry per bit.
 
-    treeNode *tmp = pop(s);
-    delStack(s);
-    return tmp;
+static uint64_t lookUp(table *t, bitReader *r, uint8_t *out, uint64_t n) {
+    uint64_t i = 0;
+    while (i < n) {
+        out[i] = decodeSymbol(t, r);
+        if (exhausted(r)) { // Ran out of input mid-symbol
+            break;
+        }
+        i += 1;
+    }
+    return i;
 }
 
-static int8_t nextBit(int file) {
-    // State required for nextBit
+// decodeFile decodes len symbols from the rest of the input with the tree
+// (when walking) or the table. A regular input file is read through its
+// mapping. A regular output file is first made long enough and mapped, so
+// the symbols go straight into place; otherwise they go out through a buffer.
+// Every symbol takes at least a bit, so the output is only mapped when len
+// is no more than the rest of the input could hold: the Header is not to be
+// trusted with the size of the file.
+
+static void decodeFile(const uint16_t *flat, table *t, int fileIn, int fileOut, uint64_t len) {
+    uint64_t inSize = 0;
+    uint8_t *in = mapInput(fileIn, &inSize);
+    off_t here = lseek(fileIn, 0, SEEK_CUR);
+
+    bitReader reader, *r = &reader;
+    uint8_t *input = NULL;
+    if (in && here >= 0 && (uint64_t) here <= inSize) {
+        newMemoryReader(r, in + here, inSize - here);
+    } else {
+        input = (uint8_t *) malloc(64 * KB);
+        if (!input) {
+            ERROR("Allocating input buffer failed");
+        }
+        newReader(r, fileIn, input, 64 * KB);
+    }
 
-    static long length = 0;
-    static int bitNo = 0;
+    off_t base = lseek(fileOut, 0, SEEK_CUR);
+    bool bounded = in && here >= 0 && (uint64_t) here <= inSize && len / 8 <= inSize - here;
+    uint8_t *out = NULL;
+    if (bounded && base >= 0 && len < UINT64_MAX - base) {
+        out = mapOutput(fileOut, base + len);
+    }
+    if (out) {
+        uint64_t n = walk ? walkTree(flat, r, out + base, len) : lookUp(t, r, out + base, len);
+        unmap(out, base + len);
+        if (n < len && ftruncate(fileOut, base + n) != 0) {
+            ERROR("Truncating output failed");
+        }
+    } else {
+        uint8_t buffer[BLK];
+        while (len > 0) {
+            uint64_t want = len < BLK ? len : BLK;
+            uint64_t n = walk ? walkTree(flat, r, buffer, want) : lookUp(t, r, buffer, want);
+            if (!writeFully(fileOut, buffer, n)) {
+                ERROR("Write of output failed");
+            }
+            if (n < want) {
+                break;
+            }
+            len -= n;
+        }
+    }
+    free(input);
+    unmap(in, inSize);
+    return;
+}
 
-    static uint8_t bytes[KB];
+// decodeBlocks decodes a file of blocks, one block at a time. If the file was
+// a stream its size is UNKNOWN, and the blocks alone say where it ends. The
+// input is read ahead and the output written behind (see flow.h), so that
+// reading, decoding and writing all go on at once.
+
+static void decodeBlocks(int fileIn, int fileOut, uint64_t len) {
+    bool known = len != UNKNOWN;
+    uint8_t *in = NULL, *out = NULL;
+    uint32_t inSize = 0, outSize = 0;
+    bool ended = false; // The end block was read
+    flow *source = newInflow(fileIn), *sink = newOutflow(fileOut);
+    if (!source || !sink) {
+        ERROR("Starting input and output failed");
+    }
 
-    int8_t bit;
-    if (bitNo == 8 * length) {
-        if ((length = read(file, bytes, KB)) > 0) {
-            bitNo = 0;
-        } else {
-            return -1;
-        } // We're done
+    Block b;
+    while (takeFlow(source, &b, sizeof(Block)) == sizeof(Block)) {
+        uint32_t raw = isBig() ? swap32(b.raw) : b.raw;
+        uint32_t packed = isBig() ? swap32(b.packed) : b.packed;
+
+        if (raw == 0) {
+            ended = true; // End of the blocks
+            break;
+        }
+        if (raw > MAXBLOCK || packed > BLOCKBOUND(MAXBLOCK) || (known && raw > len)) {
+            ERROR("Incorrect block");
+        }
+        if (packed > inSize) {
+            in = (uint8_t *) realloc(in, inSize = packed);
+        }
+        if (raw > outSize) {
+            out = (uint8_t *) realloc(out, outSize = raw);
+        }
+        if (!in || !out) {
+            ERROR("Allocating block buffers failed");
+        }
+        if (takeFlow(source, in, packed) != packed) {
+            ERROR("Read of block failed");
+        }
+        if (!decodeBlock(in, packed, out, raw)) {
+            ERROR("Incorrect block");
+        }
+        if (!putFlow(sink, out, raw)) {
+            ERROR("Write of output failed");
+        }
+        len -= raw;
     }
-    bit = (bytes[bitNo / 8] >> (bitNo % 8)) & 0x1;
-    bitNo += 1;
-    return bit;
+    free(in);
+    free(out);
+    if (!delFlow(sink)) {
+        ERROR("Write of output failed");
+    }
+    if (!delFlow(source) || !ended || (known && len > 0)) {
+        ERROR("Read of blocks failed");
+    }
+    return;
 }
 
-static void decodeFile(treeNode *root, int fileIn, int fileOut, uint64_t len) {
-    treeNode *r = root;
+// decodeParallel decodes the blocks on a pool of threads. With an index each
+// worker reads its own block; otherwise the blocks are read here, in order,
+// and handed out. If the output is a regular file each worker writes its
+// block directly into place, otherwise the blocks are written out here in
+// order. As when encoding, there are twice as many jobs as threads. Blocks
+// read in order come through a flow, as do blocks written out in order.
+
+typedef struct blockJob {
+    job j;
+    int fileIn, fileOut;
+    bool indexed; // Read the block at offset
+    bool place; // Write the block at position
+    uint64_t offset, position;
+    uint32_t raw, packed;
+    uint32_t inSize, outSize;
+    uint8_t *in, *out;
+    bool ok;
+} blockJob;
+
+static bool readBlock(blockJob *b) {
+    Block k;
+    if (!readAt(b->fileIn, &k, sizeof(Block), b->offset)) {
+        return false;
+    }
+    b->raw = isBig() ? swap32(k.raw) : k.raw;
+    b->packed = isBig() ? swap32(k.packed) : k.packed;
+    if (b->raw == 0 || b->raw > MAXBLOCK || b->packed > BLOCKBOUND(MAXBLOCK)
+        || !grow(&b->in, &b->inSize, b->packed)) {
+        return false;
+    }
+    return readAt(b->fileIn, b->in, b->packed, b->offset + sizeof(Block));
+}
 
-    uint8_t buffer[BLK];
-    uint32_t bP = 0;
+static void runBlock(job *j) {
+    blockJob *b = (blockJob *) j;
 
-    if (r) {
-        int8_t b;
+    b->ok = (!b->indexed || readBlock(b)) && grow(&b->out, &b->outSize, b->raw)
+            && decodeBlock(b->in, b->packed, b->out, b->raw)
+            && (!b->place || writeAt(b->fileOut, b->out, b->raw, b->position));
+    return;
+}
+
+static void decodeParallel(int fileIn, int fileOut, uint64_t len) {
+    bool known = len != UNKNOWN;
+    uint64_t blocks = 0;
+    Index *index = readIndex(fileIn, &blocks);
+
+    struct stat s;
+    off_t base = lseek(fileOut, 0, SEEK_CUR);
+    bool place = fstat(fileOut, &s) == 0 && S_ISREG(s.st_mode) && base >= 0;
+
+    pool *p = newPool(threads);
+    uint32_t slots = 2 * threads;
+    blockJob *jobs = (blockJob *) calloc(slots, sizeof(blockJob));
+    flow *source = index ? NULL : newInflow(fileIn), *sink = place ? NULL : newOutflow(fileOut);
+    if (!p || !jobs || (!index && !source) || (!place && !sink)) {
+        ERROR("Starting threads failed");
+    }
+    for (uint32_t i = 0; i < slots; i += 1) {
+        jobs[i] = (blockJob) { .j.run = runBlock, .fileIn = fileIn, .fileOut = fileOut };
+        jobs[i].indexed = index != NULL;
+        jobs[i].place = place;
+    }
+
+    uint64_t next = 0, done = 0, position = 0, size = len;
+    bool more = true;
+    while (more || done < next) {
+        while (more && next - done < slots) { // Hand out the next block
+            blockJob *b = &jobs[next % slots];
+            if (index) {
+                if (next == blocks) {
+                    more = false;
+                    break;
+                }
+                b->offset = index[next].offset;
+                b->position = index[next].position;
+            } else {
+                Block k;
+                if (takeFlow(source, &k, sizeof(Block)) != sizeof(Block)) {
+                    ERROR("Read of block failed");
+                }
+                b->raw = isBig() ? swap32(k.raw) : k.raw;
+                b->packed = isBig() ? swap32(k.packed) : k.packed;
+                if (b->raw == 0) {
+                    more = false;
+                    break;
+                }
+                if (b->raw > MAXBLOCK || b->packed > BLOCKBOUND(MAXBLOCK)
+                    || !grow(&b->in, &b->inSize, b->packed)
+                    || takeFlow(source, b->in, b->packed) != b->packed) {
+                    ERROR("Read of block failed");
+                }
+                b->position = position;
+                position += b->raw;
+            }
+            b->position += base;
+            submit(p, &b->j);
+            next += 1;
+        }
+        if (done < next) { // Wait for the oldest block
+            blockJob *b = &jobs[done % slots];
+            await(p, &b->j);
+            if (!b->ok || (known && b->raw > len)
+                || (index && b->position - base + b->raw > size)) {
+                ERROR("Incorrect block");
+            }
+            if (!place && !putFlow(sink, b->out, b->raw)) {
+                ERROR("Write of output failed");
+            }
+            len -= b->raw;
+            done += 1;
+        }
+    }
 
-        // Do not decode extra bits (len)
+    delPool(p);
+    for (uint32_t i = 0; i < slots; i += 1) {
+        free(jobs[i].in);
+        free(jobs[i].out);
+    }
+    free(jobs);
+    free(index);
+    if (sink && !delFlow(sink)) {
+        ERROR("Write of output failed");
+    }
+    if ((source && !delFlow(source)) || (known && len > 0)) {
+        ERROR("Read of blocks failed");
+    }
+    return;
+}
+
+// decodeAdaptive decodes each read of input as it arrives, and writes out
+// whatever it produced before it waits for more, so that nothing is held
+// back on a live stream. It stops at END.
 
-        while (len > 0 && (b = nextBit(fileIn)) >= 0) {
-            // Walk left on 0, right on 1.
-            // This is safe because the root can never decode to a symbol.
-            r = (b == 0) ? r->left : r->right;
+static void decodeAdaptive(int fileIn, int fileOut, uint64_t len) {
+    adaptive *a = newAdaptive();
+    uint8_t *in = (uint8_t *) malloc(64 * KB);
+    uint8_t *out = (uint8_t *) malloc(64 * KB);
+    if (!a || !in || !out) {
+        ERROR("Allocating adaptive decoder failed");
+    }
 
-            // Emit symbol when leaf is reached, reset to root.
-            if (r->leaf) {
-                len -= 1;
-                buffer[bP++] = r->symbol;
-                if (bP == BLK) {
-                    write(fileOut, buffer, bP);
-                    bP = 0;
+    uint64_t total = 0;
+    bool done = false;
+    ssize_t count;
+    while (!done && (count = read(fileIn, in, 64 * KB)) > 0) {
+        uint32_t bP = 0;
+        for (ssize_t i = 0; i < count && !done; i += 1) {
+            for (uint32_t j = 0; j < 8 && !done; j += 1) {
+                int32_t s = adaptiveDecode(a, in[i] >> j & 1);
+                if (s == -2) {
+                    ERROR("Incorrect adaptive code");
+                } else if (s == END) {
+                    done = true;
+                } else if (s >= 0) {
+                    out[bP++] = s;
+                    if (bP == 64 * KB) {
+                        if (!writeFully(fileOut, out, bP)) {
+                            ERROR("Write of output failed");
+                        }
+                        bP = 0;
+                    }
+                    total += 1;
                 }
-                r = root;
             }
         }
+        if (!writeFully(fileOut, out, bP)) {
+            ERROR("Write of output failed");
+        }
+    }
+
+    free(in);
+    free(out);
+    delAdaptive(a);
+    if (!done || (len != UNKNOWN && total != len)) {
+        ERROR("Read of adaptive code failed");
+    }
+    return;
+}
+
+// decodeRange decodes only the bytes [offset, offset + length) of a file of
+// blocks, a block at a time.
+
+static void decodeRange(int fileIn, int fileOut) {
+    blockFile *f = openBlocks(fileIn);
+    if (!f) {
+        ERROR("Random access needs a file of blocks (encode -b)");
+    }
+
+    uint8_t *buffer = (uint8_t *) malloc(KB * KB);
+    if (!buffer) {
+        ERROR("Allocating buffer failed");
+    }
+
+    uint64_t offset = rangeOffset, length = rangeLength;
+    int64_t count = 0;
+    while (length > 0
+           && (count = readBlocks(f, offset, length < KB * KB ? length : KB * KB, buffer)) > 0) {
+        if (!writeFully(fileOut, buffer, count)) {
+            ERROR("Write of output failed");
+        }
+        offset += count;
+        length -= count;
     }
-    if (bP != 0) // Remainder
-    {
-        write(fileOut, buffer, bP);
+    free(buffer);
+    closeBlocks(f);
+    if (count < 0) {
+        ERROR("Incorrect block");
     }
     return;
 }
 
+// In batch mode each file is decoded by one worker on its own, from memory:
+// a small file is read whole into the worker's buffer, a large one mapped.
+// Files of blocks are decoded a block at a time, and canonical codes and
+// saved tables with a decoding table. A saved table is loaded once for the
+// whole batch. A tree or an adaptive code is left to a decode of its own.
+
+static pthread_mutex_t loading = PTHREAD_MUTEX_INITIALIZER;
+static table *loaded[UINT16_MAX + 1]; // Saved tables, by ID
+
+static table *savedTable(uint16_t id) {
+    pthread_mutex_lock(&loading);
+    if (!loaded[id]) {
+        uint8_t lengths[BYTE];
+        code codes[BYTE];
+        if (loadTable(tables, id, lengths) && canonicalCodes(lengths, BYTE, codes)) {
+            loaded[id] = newTable(codes, BYTE);
+        }
+    }
+    table *t = loaded[id];
+    pthread_mutex_unlock(&loading);
+    return t;
+}
+
+static const char *decodeBlocksOne(worker *w, const uint8_t *in, uint64_t n, int fileOut,
+                                   uint64_t len) {
+    bool known = len != UNKNOWN;
+    uint64_t p = sizeof(Header), total = 0;
+    while (true) {
+        Block k;
+        if (n - p < sizeof(Block)) {
+            return "read of block failed";
+        }
+        memcpy(&k, in + p, sizeof(Block));
+        p += sizeof(Block);
+        uint32_t raw = isBig() ? swap32(k.raw) : k.raw;
+        uint32_t packed = isBig() ? swap32(k.packed) : k.packed;
+        if (raw == 0) {
+            break; // End of the blocks
+        }
+        if (raw > MAXBLOCK || packed > n - p || (known && raw > len - total)) {
+            return "incorrect block";
+        }
+        if (!grow(&w->out, &w->outSize, raw)) {
+            return strerror(ENOMEM);
+        }
+        if (!decodeBlock(in + p, packed, w->out, raw)) {
+            return "incorrect block";
+        }
+        if (!writeFully(fileOut, w->out, raw)) {
+            return strerror(errno);
+        }
+        w->written += raw;
+        p += packed;
+        total += raw;
+    }
+    return known && total != len ? "read of blocks failed" : NULL;
+}
+
+static const char *decodeTableOne(worker *w, table *t, const uint8_t *in, uint64_t n, int fileOut,
+                                  uint64_t len) {
+    if (!grow(&w->out, &w->outSize, 64 * KB)) {
+        return strerror(ENOMEM);
+    }
+    bool known = len != UNKNOWN;
+    bitReader reader, *r = &reader;
+    newMemoryReader(r, in, n);
+    while (len > 0) {
+        uint64_t want = len < 64 * KB ? len : 64 * KB;
+        uint64_t got = lookUp(t, r, w->out, want);
+        if (!writeFully(fileOut, w->out, got)) {
+            return strerror(errno);
+        }
+        w->written += got;
+        if (got < want) { // A stream of unknown size ends with its code
+            return known ? "read of code failed" : NULL;
+        }
+        len -= got;
+    }
+    return NULL;
+}
+
+// An adaptive code is taken a bit at a time until END, and its bytes go out
+// 64 KB at a time.
+
+static const char *decodeAdaptiveOne(worker *w, const uint8_t *in, uint64_t n, int fileOut,
+                                     uint64_t len) {
+    adaptive *a = newAdaptive();
+    if (!a || !grow(&w->out, &w->outSize, 64 * KB)) {
+        delAdaptive(a);
+        return strerror(ENOMEM);
+    }
+    uint64_t total = 0;
+    uint32_t have = 0;
+    int32_t s = -1;
+    bool ok = true;
+    for (uint64_t i = 0; i < 8 * n && s != END && s != -2 && ok; i += 1) {
+        s = adaptiveDecode(a, in[i / 8] >> i % 8 & 1);
+        if (s >= 0 && s != END) {
+            w->out[have++] = s;
+            total += 1;
+        }
+        if (have == 64 * KB) {
+            ok = writeFully(fileOut, w->out, have);
+            w->written += have;
+            have = 0;
+        }
+    }
+    ok = ok && writeFully(fileOut, w->out, have);
+    w->written += have;
+    delAdaptive(a);
+    if (!ok) {
+        return strerror(errno);
+    }
+    return s != END || (len != UNKNOWN && total != len) ? "read of adaptive code failed" : NULL;
+}
+
+static const char *decodeCoded(worker *w, const uint8_t *in, uint64_t n, int fileOut) {
+    Header h;
+    if (n < sizeof(Header)) {
+        return "read of header failed";
+    }
+    memcpy(&h, in, sizeof(Header));
+    uint32_t magic = isBig() ? swap32(h.magic) : h.magic;
+    uint16_t treeBytes = isBig() ? swap16(h.tree_size) : h.tree_size;
+    uint16_t permissions = isBig() ? swap16(h.permissions) : h.permissions;
+    uint64_t origSize = isBig() ? swap64(h.file_size) : h.file_size;
+
+    if (magic != MAGIC && magic != CANONICAL && magic != BLOCKS && magic != ADAPTIVE
+        && magic != DICTIONARY) {
+        return "read of magic number failed";
+    }
+    if (fchmod(fileOut, permissions) != 0) {
+        return strerror(errno);
+    }
+    if (magic == BLOCKS) {
+        return decodeBlocksOne(w, in, n, fileOut, origSize);
+    } else if (magic == DICTIONARY) {
+        table *t = savedTable(treeBytes);
+        return t ? decodeTableOne(w, t, in + sizeof(Header), n - sizeof(Header), fileOut, origSize)
+                 : "loading saved table failed";
+    } else if (magic == CANONICAL) {
+        uint8_t lengths[BYTE];
+        code codes[BYTE];
+        if (treeBytes > n - sizeof(Header)
+            || !loadLengths(in + sizeof(Header), treeBytes, BYTE, lengths)
+            || !canonicalCodes(lengths, BYTE, codes)) {
+            return "loading code lengths failed";
+        }
+        table *t = newTable(codes, BYTE);
+        if (!t) {
+            return strerror(ENOMEM);
+        }
+        uint64_t p = sizeof(Header) + treeBytes;
+        const char *why = decodeTableOne(w, t, in + p, n - p, fileOut, origSize);
+        delTable(t);
+        return why;
+    } else if (magic == ADAPTIVE) {
+        return decodeAdaptiveOne(w, in + sizeof(Header), n - sizeof(Header), fileOut, origSize);
+    }
+
+    // A tree is decoded, as it is without -w, through a table of its codes.
+
+    tree *t = treeBytes <= n - sizeof(Header) ? loadTree(in + sizeof(Header), treeBytes) : NULL;
+    if (!t) {
+        return "loading tree failed";
+    }
+    code codes[BYTE];
+    for (uint32_t i = 0; i < BYTE; i += 1) {
+        codes[i] = newCode();
+    }
+    buildCode(newCode(), t, codes);
+    delTree(t);
+    table *d = newTable(codes, BYTE);
+    if (!d) {
+        return strerror(ENOMEM);
+    }
+    uint64_t p = sizeof(Header) + treeBytes;
+    const char *why = decodeTableOne(w, d, in + p, n - p, fileOut, origSize);
+    delTable(d);
+    return why;
+}
+
+static const char *decodeOne(worker *w, int fileIn, const struct stat *s, int fileOut) {
+    uint64_t n = s->st_size;
+    uint8_t *map = n >= KB * KB ? mapInput(fileIn, &n) : NULL;
+    if (!map && (n > MAXBLOCK || !grow(&w->in, &w->inSize, n ? n : 1))) {
+        return strerror(ENOMEM);
+    }
+    if (!map && !readFully(fileIn, w->in, n)) {
+        return "read of input failed";
+    }
+    const char *why = decodeCoded(w, map ? map : w->in, n, fileOut);
+    unmap(map, n);
+    return why;
+}
+
+// Open an archive and read its directory. The table that its members share,
+// if any, is taken as the saved table with that ID for the whole of it.
+
+static directory *openArchive(const char *name, int *file) {
+    if ((*file = open(name, O_RDONLY)) < 0) {
+        perror(name);
+        exit(1);
+    }
+    Header h;
+    if (!readAt(*file, &h, sizeof(Header), 0)
+        || (isBig() ? swap32(h.magic) : h.magic) != ARCHIVE) {
+        ERROR("Not an archive");
+    }
+    uint16_t sharedBytes = isBig() ? swap16(h.tree_size) : h.tree_size;
+    if (sharedBytes > 0) {
+        uint8_t shared[UINT16_MAX], lengths[BYTE];
+        code codes[BYTE];
+        if (sharedBytes < 2 || !readAt(*file, shared, sharedBytes, sizeof(Header))
+            || !loadLengths(shared + 2, sharedBytes - 2, BYTE, lengths)
+            || !canonicalCodes(lengths, BYTE, codes)) {
+            ERROR("Loading shared table failed");
+        }
+        uint16_t id = shared[0] | shared[1] << 8;
+        if (!(loaded[id] = newTable(codes, BYTE))) {
+            ERROR("Allocating shared table failed");
+        }
+    }
+    directory *d = readDirectory(*file);
+    if (!d) {
+        ERROR("Incorrect archive directory");
+    }
+    return d;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-pvw] [-i input] [-o output] [-t threads] [-d tables]\n", name);
+    fprintf(stderr, "       [-O offset] [-L length] [-B names...] [-A archive [-l] [names...]]\n");
+    exit(EXIT_FAILURE);
+}
+
+// Read a count of bytes, which must be all decimal digits: no sign, no space
+// before it and nothing after it.
+
+static bool readCount(const char *s, uint64_t *n) {
+    char *end;
+    errno = 0;
+    *n = strtoull(s, &end, 10);
+    return isdigit((unsigned char) *s) && *end == '\0' && errno == 0;
+}
+
 int main(int argc, char **argv) {
     int fileIn = 0, fileOut = 1;
     char *inputFile = NULL, *outputFile = NULL;
+    bool batch = false, list = false;
+    char *archive = NULL; // Take the named members (or all) out of this archive (-A)
+    char **names = (char **) calloc(argc, sizeof(char *)); // Files to decode in a batch
+    uint32_t count = 0;
+    if (!names) {
+        ERROR("Allocating names failed");
+    }
 
     static struct option options[] = { { "input", required_argument, NULL, 'i' },
         { "output", required_argument, NULL, 'o' }, { "verbose", no_argument, &verbose, 'v' },
-        { "print", no_argument, &print, 'p' }, { NULL, 0, NULL, 0 } };
+        { "print", no_argument, &print, 'p' }, { "walk", no_argument, &walk, 'w' },
+        { "threads", required_argument, NULL, 't' }, { "offset", required_argument, NULL, 'O' },
+        { "length", required_argument, NULL, 'L' }, { "tables", required_argument, NULL, 'd' },
+        { "batch", no_argument, NULL, 'B' }, { "archive", required_argument, NULL, 'A' },
+        { "list", no_argument, NULL, 'l' }, { NULL, 0, NULL, 0 } };
 
     int c;
-    while ((c = getopt_long(argc, argv, "-pvi:o:", options, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "-pvwBli:o:t:O:L:d:A:", options, NULL)) != -1) {
         switch (c) {
+        case 1: {
+            names[count++] = optarg;
+            break;
+        }
         case 'i': {
             inputFile = strdup(optarg);
             break;
@@ -154,8 +752,85 @@ int main(int argc, char **argv) {
             print = true;
             break;
         }
+        case 'w': {
+            walk = true;
+            break;
+        }
+        case 't': {
+            uint64_t n;
+            if (!readCount(optarg, &n) || n > MAXTHREADS) {
+                usage(argv[0]);
+            }
+            threads = n ? n : cores();
+            break;
+        }
+        case 'O': {
+            if (!readCount(optarg, &rangeOffset)) {
+                usage(argv[0]);
+            }
+            ranged = true;
+            break;
+        }
+        case 'L': {
+            if (!readCount(optarg, &rangeLength)) {
+                usage(argv[0]);
+            }
+            ranged = true;
+            break;
+        }
+        case 'd': {
+            tables = optarg;
+            break;
+        }
+        case 'B': {
+            batch = true;
+            break;
+        }
+        case 'A': {
+            archive = optarg;
+            batch = true;
+            break;
+        }
+        case 'l': {
+            list = true;
+            break;
+        }
+        case '?': {
+            usage(argv[0]);
+        }
+        }
+    }
+
+    // A batch names its own outputs, taking .huf off the name of each input.
+    if (batch) {
+        if (inputFile || outputFile || ranged || print || walk) {
+            ERROR("A batch takes only names, and does no ranges, printing or walking");
+        }
+        bool ok;
+        if (archive) {
+            int file;
+            directory *d = openArchive(archive, &file);
+            if (list) {
+                for (uint64_t i = 0; i < d->count; i += 1) {
+                    const member *m = &d->members[i];
+                    printf("%12" PRIu64 " %12" PRIu64 " %s\n", m->e.raw, m->e.packed, m->name);
+                }
+                ok = true;
+            } else {
+                ok = unpackBatch(argv[0], file, d, names, count, threads, decodeCoded, verbose);
+            }
+            delDirectory(d);
+            close(file);
+        } else {
+            ok = runBatch(argv[0], names, count, threads, ".huf", false, decodeOne, verbose);
         }
+        for (uint32_t i = 0; i <= UINT16_MAX; i += 1) {
+            delTable(loaded[i]);
+        }
+        free(names);
+        exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
     }
+    free(names);
 
     if (inputFile) {
         if ((fileIn = open(inputFile, O_RDONLY)) < 0) {
@@ -186,7 +861,7 @@ int main(int argc, char **argv) {
 
     // Read and validate header.
     Header h;
-    if (read(fileIn, &h, sizeof(Header)) < (ssize_t) sizeof(Header)) {
+    if (!readFully(fileIn, &h, sizeof(Header))) {
         ERROR("Read of header failed");
     }
 
@@ -195,45 +870,120 @@ int main(int argc, char **argv) {
     uint16_t permissions = isBig() ? swap16(h.permissions) : h.permissions;
     uint64_t origSize = isBig() ? swap64(h.file_size) : h.file_size;
 
-    if (magic != MAGIC) {
+    if (magic != MAGIC && magic != CANONICAL && magic != BLOCKS && magic != ADAPTIVE
+        && magic != DICTIONARY) {
         ERROR("Read of magic number failed");
     }
+    if (ranged) {
+        decodeRange(fileIn, fileOut);
+        close(fileIn);
+        close(fileOut);
+        exit(EXIT_SUCCESS);
+    }
     if (fileOut != STDOUT_FILENO && fchmod(fileOut, permissions) == -1) {
         ERROR("Change of output file permissions failed");
     }
 
-    uint8_t savedTree[treeBytes];
+    // An adaptive code builds its tree as it goes.
+
+    if (magic == ADAPTIVE) {
+        if (verbose && origSize == UNKNOWN) {
+            fprintf(stderr, "Original size unknown: adaptive\n");
+        } else if (verbose) {
+            fprintf(stderr, "Original %" PRIu64 " bits: adaptive\n", origSize * 8);
+        }
+        decodeAdaptive(fileIn, fileOut, origSize);
+        close(fileIn);
+        close(fileOut);
+        exit(EXIT_SUCCESS);
+    }
+
+    // Every block of a file of blocks carries its own code, so there is no
+    // tree to read.
+
+    if (magic == BLOCKS) {
+        if (verbose && origSize == UNKNOWN) {
+            fprintf(stderr, "Original size unknown: blocks\n");
+        } else if (verbose) {
+            fprintf(stderr, "Original %" PRIu64 " bits: blocks\n", origSize * 8);
+        }
+        if (threads) {
+            decodeParallel(fileIn, fileOut, origSize);
+        } else {
+            decodeBlocks(fileIn, fileOut, origSize);
+        }
+        close(fileIn);
+        close(fileOut);
+        exit(EXIT_SUCCESS);
+    }
 
-    // Pipes require this since they may return less than requested
+    // A saved table is named by its ID where the size of the tree would be.
 
-    long readSz = 0, sum = 0;
-    do {
-        readSz = read(fileIn, savedTree + sum, treeBytes - sum);
-        sum += readSz;
-    } while (sum < treeBytes && readSz > 0);
+    uint16_t id = treeBytes;
+    treeBytes = magic == DICTIONARY ? 0 : treeBytes;
+    uint8_t savedTree[treeBytes ? treeBytes : 1];
 
-    if (sum < treeBytes) {
+    if (!readFully(fileIn, savedTree, treeBytes)) {
         ERROR("Read of tree failed");
     }
 
-    // Build a new tree
+    // Build a new tree, or for a canonical code just the codes themselves
 
-    treeNode *t = loadTree(savedTree, treeBytes);
-    if (t == NULL) {
-        ERROR("Loading tree failed");
+    tree *t = NULL;
+    code codes[BYTE];
+    if (magic == DICTIONARY) {
+        uint8_t lengths[BYTE];
+        if (!loadTable(tables, id, lengths) || !canonicalCodes(lengths, BYTE, codes)) {
+            ERROR("Loading saved table failed");
+        }
+    } else if (magic == CANONICAL) {
+        uint8_t lengths[BYTE];
+        if (!loadLengths(savedTree, treeBytes, BYTE, lengths)
+            || !canonicalCodes(lengths, BYTE, codes)) {
+            ERROR("Loading code lengths failed");
+        }
+    } else {
+        t = loadTree(savedTree, treeBytes);
+        if (t == NULL) {
+            ERROR("Loading tree failed");
+        }
+        for (uint32_t i = 0; i < BYTE; i += 1) {
+            codes[i] = newCode();
+        }
+        buildCode(newCode(), t, codes);
     }
 
     if (verbose) {
-        fprintf(stderr, "Original %" PRIu64 " bits: ", origSize * 8);
-        fprintf(stderr, "tree (%u)\n", treeBytes);
+        if (origSize == UNKNOWN) {
+            fprintf(stderr, "Original size unknown: ");
+        } else {
+            fprintf(stderr, "Original %" PRIu64 " bits: ", origSize * 8);
+        }
+        if (magic == DICTIONARY) {
+            fprintf(stderr, "table %04x\n", id);
+        } else {
+            fprintf(stderr, "%s (%u)\n", t ? "tree" : "lengths", treeBytes);
+        }
     }
 
-    // Decode to the original content
+    // Decode to the original content. There is no tree to walk for a
+    // canonical code, so it is always decoded with a table.
 
-    decodeFile(t, fileIn, fileOut, origSize);
+    walk = walk && t;
+    uint16_t *flat = walk ? flattenTree(t) : NULL;
+    if (walk && !flat) {
+        ERROR("Flattening tree failed");
+    }
+    table *d = walk ? NULL : newTable(codes, BYTE);
+    if (!walk && !d) {
+        ERROR("Building decoding table failed");
+    }
+    decodeFile(flat, d, fileIn, fileOut, origSize);
+    delTable(d);
+    free(flat);
 
     if (print) {
-        printTree(t, 0);
+        printTree(t);
     }
 
     close(fileIn);
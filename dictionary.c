@@ -0,0 +1,84 @@
+#include "dictionary.h"
+
+#include "endian.h"
+#include "huffman.h"
+#include "io.h"
+#include "sizes.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+const char *tableDirectory(const char *dir) {
+    if (dir) {
+        return dir;
+    }
+    const char *env = getenv(TABLES);
+    return env && *env ? env : ".";
+}
+
+// FNV-1a over the lengths, folded to 16 bits.
+
+uint16_t tableId(const uint8_t l[]) {
+    uint32_t h = 2166136261u;
+    for (uint32_t s = 0; s < BYTE; s += 1) {
+        h = (h ^ l[s]) * 16777619u;
+    }
+    return (uint16_t) (h ^ h >> 16);
+}
+
+static void tablePath(const char *dir, uint16_t id, char path[], size_t n) {
+    snprintf(path, n, "%s/%04x.table", tableDirectory(dir), id);
+    return;
+}
+
+bool loadTable(const char *dir, uint16_t id, uint8_t l[]) {
+    char path[KB];
+    tablePath(dir, id, path, sizeof(path));
+    int file = open(path, O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+
+    TableHeader h;
+    uint8_t b[LENGTHS];
+    bool ok = readFully(file, &h, sizeof(TableHeader));
+    uint16_t bytes = isBig() ? swap16(h.bytes) : h.bytes;
+    ok = ok && (isBig() ? swap32(h.magic) : h.magic) == DICTIONARY
+         && (isBig() ? swap16(h.id) : h.id) == id && bytes <= LENGTHS;
+    ok = ok && readFully(file, b, bytes) && loadLengths(b, bytes, BYTE, l);
+    close(file);
+    return ok;
+}
+
+bool saveTable(const char *dir, uint16_t id, uint8_t l[]) {
+    uint8_t old[BYTE];
+    if (loadTable(dir, id, old)) {
+        return memcmp(old, l, BYTE) == 0;
+    }
+
+    char path[KB];
+    tablePath(dir, id, path, sizeof(path));
+    int file = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+    if (file < 0) {
+        return false;
+    }
+
+    uint8_t b[LENGTHS];
+    uint16_t bytes = dumpLengths(l, BYTE, b);
+    TableHeader h = {
+        .magic = isBig() ? swap32(DICTIONARY) : DICTIONARY,
+        .id = isBig() ? swap16(id) : id,
+        .bytes = isBig() ? swap16(bytes) : bytes,
+    };
+    bool ok = writeFully(file, &h, sizeof(TableHeader)) && writeFully(file, b, bytes);
+    if (close(file) != 0 || !ok) {
+        unlink(path);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "canon.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A dictionary is a canonical code trained ahead of time on sample files (by
+// train) and saved under a 16-bit ID. A file coded with it (magic DICTIONARY)
+// carries no code at all: the ID takes the place of tree_size in its Header,
+// and the decoder loads the same code lengths from its own copy of the table.
+// The encoder needs no histogram either, so it reads its input only once.
+//
+// Tables live in a directory, by default $HUFFMAN_TABLES or else the current
+// directory, one file per ID named for it in hex (00a7.table). The file is a
+// TableHeader followed by the lengths as dumpLengths saves them.
+
+typedef struct TableHeader {
+    uint32_t magic; // DICTIONARY
+    uint16_t id;
+    uint16_t bytes; // Bytes of lengths that follow
+} TableHeader;
+
+#define TABLES "HUFFMAN_TABLES" // Environment variable naming the directory
+
+// The directory to use when none was given.
+
+extern const char *tableDirectory(const char *dir);
+
+// The ID that a table gets unless it is given one: a hash of its lengths.
+
+extern uint16_t tableId(const uint8_t l[]);
+
+// Save the lengths as table id. It fails if a different table already has
+// that ID, but saving the same table again is fine.
+
+extern bool saveTable(const char *dir, uint16_t id, uint8_t l[]);
+
+extern bool loadTable(const char *dir, uint16_t id, uint8_t l[]);
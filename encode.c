@@ -1,11 +1,26 @@
+#include "adaptive.h"
+#include "batch.h"
+#include "bits.h"
+#include "block.h"
+#include "canon.h"
 #include "code.h"
+#include "context.h"
+#include "dictionary.h"
+#include "flow.h"
 #include "usage.h"
 #include "endian.h"
 #include "header.h"
+#include "histogram.h"
 #include "huffman.h"
+#include "io.h"
+#include "lz77.h"
+#include "map.h"
+#include "pool.h"
 #include "queue.h"
 #include "sizes.h"
 
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
@@ -35,10 +50,28 @@ static inline char *strdup_fallback(const char *s) {
 static int verbose = false;
 static int print = false;
 static int fullTree = false;
-
-static uint32_t magicNumber = MAGIC;
-static uint16_t leaves = 0;
-static uint16_t treeBytes;
+static int canonical = false;
+static uint32_t limit = 0;
+static uint32_t streams = 1;
+static uint32_t clusters = 1; // Order-1 code tables per block (-k)
+static uint32_t transforms = 0; // Transforms to try on each block (-r, -z, -W)
+static uint32_t level = 0; // Effort to find matches in each block, zero for none (-1 to -9)
+static uint32_t window = WINDOW; // How far back matches may be (-w)
+static int adaptiveMode = false;
+static bool blocks = false;
+static int stream = false;
+static uint32_t threads = 0;
+static uint32_t blockSize = KB * KB;
+static int32_t tableNumber = -1; // Code with this saved table (-x)
+static char *tables = NULL;
+static code tableCode[BYTE]; // The codes of that table, once loaded for a batch (-B)
+static wordCode tableWords[BYTE];
+static uint32_t tableLongest; // Bits in its longest code
+
+static bool isRegular(int file) {
+    struct stat s;
+    return fstat(file, &s) == 0 && S_ISREG(s.st_mode);
+}
 
 // A temporary file, since mkstemp() is not ANSI.
 
@@ -52,152 +85,439 @@ static int Mymktemp(void) {
     return fileOut;
 }
 
-// Count the number of occurences of each symbol in the file.
+// Count the number of occurences of each symbol in the file, or in its
+// mapping if it has one.
 
-static uint8_t histogram(int file, uint64_t hist[]) {
-    uint8_t b[KB] = { 0 };
-    uint16_t unique = 0; // If for some reason there is a file of each possible 8-bit value.
+static void histogram(int file, const uint8_t *map, uint64_t size, uint64_t hist[]) {
+    if (map) {
+        countBytes(map, size, hist);
+        return;
+    }
+
+    uint8_t *b = (uint8_t *) malloc(64 * KB);
+    if (!b) {
+        perror("histogram");
+        exit(EXIT_FAILURE);
+    }
 
     lseek(file, 0, SEEK_SET); // Start of the file
 
     long count;
-    while ((count = read(file, b, KB)) > 0) {
-        for (int i = 0; i < count; i += 1) {
-            if (hist[b[i]] == 0) { // Count the number of symbols that occur
-                unique += 1;
-            }
-            hist[b[i]] += 1;
-        }
+    while ((count = read(file, b, 64 * KB)) > 0) {
+        countBytes(b, count, hist);
     }
-    return unique;
+    free(b);
+    return;
+}
+
+static tree *buildTree(int inFile, const uint8_t *map, uint64_t size, uint64_t hist[]) {
+    histogram(inFile, map, size, hist);
+    return huffmanTree(hist, BYTE, fullTree);
 }
 
-bool buffered_write(int file, uint8_t b[], uint32_t l, bool flush) {
-    static char buffer[BLK];
-    static int blkP = 0;
-    for (uint32_t i = 0; i < l; i += 1) {
-        buffer[blkP] = b[i];
-        blkP += 1;
-        if (blkP == BLK) { // Buffer is full
-            if (write(file, buffer, BLK) < BLK) { // Clear the buffer
-                return false; // write failed
+// encodeBytes appends the code for each byte as a single word-sized shift.
+// Only codes longer than 64 bits are appended piecewise from the full code.
+
+static void encodeBytes(bitWriter *out, const wordCode w[], code c[], const uint8_t b[], size_t n) {
+    for (size_t i = 0; i < n; i += 1) { // Scan through the block
+        if (w[b[i]].l) {
+            putBits(out, w[b[i]].bits, w[b[i]].l); // Append the code for each byte
+        } else {
+            for (uint32_t j = 0; j < c[b[i]].l; j += 32) {
+                uint32_t l = c[b[i]].l - j < 32 ? c[b[i]].l - j : 32;
+                putBits(out, codeBits(&c[b[i]], j, l), l);
             }
-            blkP = 0;
         }
     }
-    if (flush && blkP > 0) { // Flush the buffer
-        if (write(file, buffer, blkP) < blkP) {
-            return false; // write failed
-        }
-        blkP = 0;
-    }
-    return true;
+    return;
 }
 
-static treeNode *buildTree(int inFile, int outFile, Header *h) {
-    uint64_t hist[BYTE] = { 0 };
+// encodeFile codes the whole file, straight from its mapping if it has one,
+// and says how many bytes it coded in size. The last byte is padded with ones
+// rather than zeros. With a saved table every byte has a code, so the longest
+// code is at least eight bits and is the only one that is all ones: the
+// padding is never a whole code, and a stream, whose size is not known when
+// the Header is written, decodes to exactly what was coded.
 
-    uint8_t unique = histogram(inFile, hist);
+static uint64_t encodeFile(int fileIn, const uint8_t *map, uint64_t *size, int fileOut, code c[]) {
+    wordCode w[BYTE];
+    for (uint32_t i = 0; i < BYTE; i += 1) {
+        w[i] = toWord(c[i]);
+    }
 
-    queue *q = newQueue(BYTE + 1);
+    uint8_t *output = (uint8_t *) malloc(64 * KB);
+    if (!output) {
+        perror("encodeFile");
+        exit(EXIT_FAILURE);
+    }
+    bitWriter writer, *out = &writer;
+    newWriter(out, fileOut, output, 64 * KB);
 
-    // The tree must have at least two symbols in order to be valid. We
-    // could special-case a zero symbol tree, but that is a waste of code
-    // for a single case.
+    if (map) {
+        encodeBytes(out, w, c, map, *size);
+    } else {
+        uint8_t b[KB];
+        long count;
+
+        lseek(fileIn, 0, SEEK_SET); // Start of the file, unless it is a stream
 
-    if (unique < 2) // Less than two symbols? We need stand-ins.
-    {
-        hist[0x00] = hist[0x00] ? hist[0x00] : hist[0x00] + 1;
-        hist[0xFF] = hist[0xFF] ? hist[0xFF] : hist[0xFF] + 1;
+        *size = 0;
+        while ((count = read(fileIn, b, KB)) > 0) { // Read a block
+            encodeBytes(out, w, c, b, count);
+            *size += count;
+        }
+    }
+    out->bits |= ~(uint64_t) 0 << out->count;
+    flushWriter(out);
+    if (out->failed) {
+        perror("encodeFile");
+        exit(EXIT_FAILURE);
     }
 
-    // We provide the option to building a full tree or a minimal tree.
+    free(output);
+    return out->total;
+}
 
-    for (uint32_t i = 0; i < BYTE; i += 1) {
-        if (fullTree || hist[i] > 0) {
-            enqueue(q, newNode(i, true, hist[i]));
-            leaves += 1;
+// encodeAdaptive codes the input in a single pass as it arrives, with no
+// tree to send. Whatever whole bytes of output there are go out as soon as
+// each read of input has been coded, so a reader at the other end of a pipe
+// does not have to wait for a buffer to fill.
+
+static uint64_t encodeAdaptive(int fileIn, int fileOut, uint64_t *size) {
+    adaptive *a = newAdaptive();
+    uint8_t *in = (uint8_t *) malloc(64 * KB);
+    uint8_t *out = (uint8_t *) malloc(64 * KB);
+    if (!a || !in || !out) {
+        perror("encodeAdaptive");
+        exit(EXIT_FAILURE);
+    }
+    bitWriter writer, *w = &writer;
+    newWriter(w, fileOut, out, 64 * KB);
+
+    uint64_t total = 0;
+    ssize_t count;
+    while ((count = read(fileIn, in, 64 * KB)) > 0) {
+        for (ssize_t i = 0; i < count; i += 1) {
+            adaptiveEncode(a, w, in[i]);
         }
+        total += count;
+        drainWriter(w);
+    }
+    adaptiveEncode(a, w, END);
+    flushWriter(w);
+    if (w->failed) {
+        perror("encodeAdaptive");
+        exit(EXIT_FAILURE);
     }
 
-    // Save the size of the tree:
-    //   1. Two bytes for each leaf
-    //   2. One byte for each internal node
-    //   3. leaves - 1 internal nodes
-    //   4. Zero is the minimum
+    free(in);
+    free(out);
+    delAdaptive(a);
+    *size = total;
+    return w->total;
+}
+
+// In block mode the input is cut into blocks of blockSize bytes, and each is
+// coded on its own by one of a pool of threads. There are twice as many jobs
+// as threads so that the workers stay busy while the blocks that are done
+// are written out in order. The index of where each block went follows the
+// blocks.
+//
+// A file is read by the workers themselves, each at the offset of its own
+// block. A stream (a pipe, say) can only be read in order, so the blocks are
+// read here and handed out; memory use is bounded by the number of jobs, and
+// nothing needs to be spooled to a temporary file. Both the stream and the
+// output go through flows, so they are read ahead and written behind while
+// the blocks are coded.
+
+typedef struct blockJob {
+    job j;
+    int file; // Read the block from here, or -1 if it has been read already
+    uint64_t offset; // Where the block starts in the input
+    uint32_t n; // Bytes of input
+    uint32_t packed; // Bytes of output, zero if reading failed
+    uint8_t *in, *out;
+} blockJob;
+
+static void runBlock(job *j) {
+    blockJob *b = (blockJob *) j;
+
+    if (b->file >= 0 && !readAt(b->file, b->in, b->n, b->offset)) {
+        b->packed = 0;
+        return;
+    }
+    b->packed = encodeBlock(b->in, b->n, b->out, limit, streams, clusters, transforms, level,
+                            window);
+    return;
+}
 
-    treeBytes = leaves > 0 ? 3 * leaves - 1 : 0;
-    h->tree_size = isBig() ? swap16(treeBytes) : treeBytes;
-    buffered_write(outFile, (uint8_t *) h, sizeof(Header), true);
+static uint64_t encodeBlocks(int fileIn, int fileOut, uint64_t *size) {
+    uint32_t workers = threads ? threads : cores();
+    uint32_t slots = 2 * workers;
+    if (!stream) { // No more jobs than blocks
+        uint64_t count = (*size + blockSize - 1) / blockSize;
+        slots = slots < count ? slots : (count ? (uint32_t) count : 1);
+    }
 
-    treeNode *t = NULL;
+    pool *p = newPool(workers);
+    blockJob *jobs = (blockJob *) calloc(slots, sizeof(blockJob));
+    uint64_t indexSize = 64;
+    Index *index = (Index *) calloc(indexSize, sizeof(Index));
+    flow *source = stream ? newInflow(fileIn) : NULL, *sink = newOutflow(fileOut);
+    if (!p || !jobs || !index || (stream && !source) || !sink) {
+        perror("encodeBlocks");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < slots; i += 1) {
+        jobs[i].j.run = runBlock;
+        jobs[i].file = stream ? -1 : fileIn;
+        jobs[i].in = (uint8_t *) malloc(blockSize);
+        jobs[i].out = (uint8_t *) malloc(BLOCKBOUND(blockSize));
+        if (!jobs[i].in || !jobs[i].out) {
+            perror("encodeBlocks");
+            exit(1);
+        }
+    }
 
-    while (!empty(q)) {
-        treeNode *l, *r;
+    uint64_t next = 0, done = 0, position = 0, bytes = 0;
+    bool more = true;
+    while (more || done < next) {
+        while (more && next - done < slots) { // Hand out the next block
+            blockJob *b = &jobs[next % slots];
+            if (stream) {
+                b->n = takeFlow(source, b->in, blockSize);
+            } else {
+                b->n = *size - position < blockSize ? *size - position : blockSize;
+            }
+            if (b->n == 0) {
+                more = false;
+                break;
+            }
+            b->offset = position;
+            position += b->n;
+            submit(p, &b->j);
+            next += 1;
+        }
+        if (done < next) { // Wait for the oldest block and write it out
+            blockJob *b = &jobs[done % slots];
+            await(p, &b->j);
+            if (b->packed == 0) {
+                fprintf(stderr, "encode: read of input failed\n");
+                exit(1);
+            }
+            if (done == indexSize) {
+                index = (Index *) realloc(index, (indexSize *= 2) * sizeof(Index));
+                if (!index) {
+                    perror("encodeBlocks");
+                    exit(1);
+                }
+            }
+            index[done] = (Index) { .offset = sizeof(Header) + bytes, .position = b->offset };
+            Block k = {
+                .raw = isBig() ? swap32(b->n) : b->n,
+                .packed = isBig() ? swap32(b->packed) : b->packed,
+            };
+            if (!putFlow(sink, &k, sizeof(Block)) || !putFlow(sink, b->out, b->packed)) {
+                perror("encode");
+                exit(1);
+            }
+            bytes += sizeof(Block) + b->packed;
+            done += 1;
+        }
+    }
 
-        dequeue(q, &l); // Left child
+    Block end = { 0, 0 };
+    if (!putFlow(sink, &end, sizeof(Block)) || !delFlow(sink)
+        || !writeIndex(fileOut, index, done)) {
+        perror("encode");
+        exit(1);
+    }
+    if (source && !delFlow(source)) {
+        perror("encode: read of input failed");
+        exit(1);
+    }
 
-        if (!empty(q)) {
-            dequeue(q, &r); // Right child
-            enqueue(q, join(l, r)); // Interior node
-        } else {
-            t = l;
-        } // Singleton is the root
+    delPool(p);
+    for (uint32_t i = 0; i < slots; i += 1) {
+        free(jobs[i].in);
+        free(jobs[i].out);
     }
-    return t;
+    free(jobs);
+    free(index);
+    *size = position;
+    return 8 * bytes;
 }
 
-void dumpTree(int fileOut, treeNode *t) {
-    static char L = 'L', I = 'I';
+// In batch mode each file is coded by one worker on its own, as a file of
+// blocks that are coded one after another, or with the saved table if there
+// is one. The output is gathered in the worker's buffer, so that a small file
+// takes a single write. For an archive (no file) the whole of it is kept
+// there, and only its length is noted at the end.
 
-    if (t) {
-        if (t->leaf) {
-            (void) buffered_write(fileOut, (uint8_t *) &L, 1, false); // Leaf indicator
-            (void) buffered_write(fileOut, (uint8_t *) &t->symbol, 1, false); // Symbol
-        } else {
-            (void) dumpTree(fileOut, t->left);
-            (void) dumpTree(fileOut, t->right);
-            (void) buffered_write(fileOut, (uint8_t *) &I, 1, false); // Interior node indicator
-        }
+static bool flushOut(worker *w, int file, uint32_t *have) {
+    if (file < 0) {
+        w->have = *have;
+        return true;
     }
-    return;
+    bool ok = writeFully(file, w->out, *have);
+    w->written += *have;
+    *have = 0;
+    return ok;
 }
 
-static void buildCode(code s, treeNode *t, code c[]) {
-    if (t) {
-        if (t->leaf) {
-            c[t->symbol] = s; // Found it
-            return;
-        } else {
-            uint32_t tmp;
+// Make sure that there is room for n more bytes of output after have.
 
-            pushCode(&s, 0); // Go left
-            buildCode(s, t->left, c);
-            popCode(&s, &tmp);
+static bool roomOut(worker *w, int file, uint32_t *have, uint32_t n) {
+    if (w->outSize - *have >= n) {
+        return true;
+    } else if (file >= 0) {
+        return flushOut(w, file, have);
+    } else if (n > UINT32_MAX - *have) {
+        errno = EFBIG;
+        return false;
+    }
+    uint32_t need = *have + n;
+    uint32_t twice = w->outSize <= UINT32_MAX / 2 ? 2 * w->outSize : UINT32_MAX;
+    return grow(&w->out, &w->outSize, need > twice ? need : twice);
+}
 
-            pushCode(&s, 1); // Go right
-            buildCode(s, t->right, c);
-            popCode(&s, &tmp);
+static const char *encodeTableOne(worker *w, int fileIn, const struct stat *s, int fileOut) {
+    uint64_t size = s->st_size;
+    if (fileOut < 0 && size > (uint64_t) (UINT32_MAX - 64) * 8 / tableLongest) {
+        return strerror(EFBIG);
+    }
+    // All of it if it is kept
+    uint32_t most = fileOut < 0 ? sizeof(Header) + (size * tableLongest + 7) / 8 + 8 : 64 * KB;
+    if (!grow(&w->in, &w->inSize, 64 * KB) || !grow(&w->out, &w->outSize, most)) {
+        return strerror(ENOMEM);
+    }
+    Header h = {
+        .magic = isBig() ? swap32(DICTIONARY) : DICTIONARY,
+        .permissions = isBig() ? swap16(s->st_mode) : s->st_mode,
+        .tree_size = isBig() ? swap16(tableNumber) : tableNumber,
+        .file_size = isBig() ? swap64(size) : size,
+    };
+    bitWriter writer, *out = &writer;
+    newWriter(out, fileOut, w->out, w->outSize);
+    memcpy(w->out, &h, sizeof(Header)); // The code bits follow it in the same buffer
+    out->p = sizeof(Header);
+
+    uint64_t left = size;
+    while (left > 0) {
+        uint32_t n = readUpTo(fileIn, w->in, left < 64 * KB ? left : 64 * KB);
+        if (n == 0) {
+            return "read of input failed";
         }
-    } else {
-        return;
+        encodeBytes(out, tableWords, tableCode, w->in, n);
+        left -= n;
+    }
+    flushWriter(out);
+    if (fileOut < 0) {
+        w->have = out->p;
+        return out->overflow ? strerror(EFBIG) : NULL;
+    } else if (out->failed) {
+        return strerror(errno);
     }
+    w->written += sizeof(Header) + (out->total + 7) / 8;
+    return NULL;
 }
 
-static void encodeFile(int fileIn, int fileOut, code c[]) {
+static const char *encodeOne(worker *w, int fileIn, const struct stat *s, int fileOut) {
+    if (tableNumber >= 0) {
+        return encodeTableOne(w, fileIn, s, fileOut);
+    }
+    uint64_t size = s->st_size, count = (size + blockSize - 1) / blockSize;
+    uint32_t most = size < blockSize ? (size ? size : 1) : blockSize;
+    if (count > UINT32_MAX / sizeof(Index) || !grow(&w->in, &w->inSize, most)
+        || !grow(&w->out, &w->outSize, sizeof(Header) + sizeof(Block) + BLOCKBOUND(most) + 2 * KB)
+        || !grow(&w->aux, &w->auxSize, (count ? count : 1) * sizeof(Index))) {
+        return strerror(ENOMEM);
+    }
+    Index *index = (Index *) w->aux;
 
-    uint8_t b[KB];
-    long count;
+    Header h = {
+        .magic = isBig() ? swap32(BLOCKS) : BLOCKS,
+        .permissions = isBig() ? swap16(s->st_mode) : s->st_mode,
+        .tree_size = 0,
+        .file_size = isBig() ? swap64(size) : size,
+    };
+    memcpy(w->out, &h, sizeof(Header));
+    uint32_t have = sizeof(Header);
+
+    uint64_t offset = sizeof(Header), position = 0;
+    for (uint64_t i = 0; i < count; i += 1) {
+        uint32_t n = size - position < blockSize ? size - position : blockSize;
+        if (readUpTo(fileIn, w->in, n) != n) {
+            return "read of input failed";
+        }
+        // Leaving room for the end
+        if (!roomOut(w, fileOut, &have, 2 * sizeof(Block) + BLOCKBOUND(n))) {
+            return strerror(errno);
+        }
+        uint32_t packed = encodeBlock(w->in, n, w->out + have + sizeof(Block), limit, streams,
+                                      clusters, transforms, level, window);
+        Block k = {
+            .raw = isBig() ? swap32(n) : n,
+            .packed = isBig() ? swap32(packed) : packed,
+        };
+        memcpy(w->out + have, &k, sizeof(Block));
+        have += sizeof(Block) + packed;
+        index[i] = (Index) { .offset = offset, .position = position };
+        offset += sizeof(Block) + packed;
+        position += n;
+    }
 
-    lseek(fileIn, 0, SEEK_SET); // Start of the file
+    // The end of the blocks, and the index a KB at a time, as writeIndex has it
 
-    while ((count = read(fileIn, b, KB)) > 0) { // Read a block
-        for (int i = 0; i < count; i += 1) { // Scan through the block
-            appendCode(fileOut, c[b[i]]); // Append the code for each byte
+    Block end = { 0, 0 };
+    memcpy(w->out + have, &end, sizeof(Block));
+    have += sizeof(Block);
+    for (uint64_t i = 0; i < count; i += KB / sizeof(Index)) {
+        uint64_t n = count - i < KB / sizeof(Index) ? count - i : KB / sizeof(Index);
+        if (!roomOut(w, fileOut, &have, KB)) {
+            return strerror(errno);
         }
+        packIndex(index + i, n, w->out + have);
+        have += n * sizeof(Index);
     }
-    flushCode(fileOut);
-    return;
+    Trailer t = packTrailer(count);
+    if (!roomOut(w, fileOut, &have, sizeof(Trailer))) {
+        return strerror(errno);
+    }
+    memcpy(w->out + have, &t, sizeof(Trailer));
+    have += sizeof(Trailer);
+    return flushOut(w, fileOut, &have) ? NULL : strerror(errno);
+}
+
+static void showUsage(const char *name) {
+    fprintf(stderr, "usage: %s [-acfpsuvmrzW] [-1 to -9] [-i input] [-o output]\n", name);
+    fprintf(stderr, "       [-l limit] [-t threads] [-b KB] [-k tables] [-w KB] [-x id]\n");
+    fprintf(stderr, "       [-d tables] [-B names...] [-A archive names...]\n");
+    exit(EXIT_FAILURE);
+}
+
+// Read a number, which must be all digits in base, no larger than most.
+// Returns false if it is not one.
+
+static bool readNumber(const char *s, int base, uint64_t most, uint64_t *n) {
+    char *end;
+    errno = 0;
+    unsigned long long k = strtoull(s, &end, base);
+    bool ok = isxdigit((unsigned char) *s) && *end == '\0' && errno == 0 && k <= most;
+    *n = ok ? k : 0;
+    return ok;
+}
+
+// Read a size given in KB, which must be all decimal digits, from 1 KB to
+// most bytes. It is checked before it is multiplied, so it cannot wrap.
+// Returns the size in bytes, or 0 if it is not one.
+
+static uint32_t readKB(const char *s, uint32_t most) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(s, &end, 10);
+    bool ok = isdigit((unsigned char) *s) && *end == '\0' && errno == 0;
+    return ok && n >= 1 && n <= most / KB ? n * KB : 0;
 }
 
 int main(int argc, char **argv) {
@@ -206,15 +526,38 @@ int main(int argc, char **argv) {
     char *inputFile = NULL;
     char *outputFile = NULL;
     bool usage = false;
+    bool batch = false;
+    bool windowed = false; // -w was given
+    uint64_t number; // The number given with an option
+    char *archive = NULL; // Pack the batch into this archive (-A)
+    char **names = (char **) calloc(argc, sizeof(char *)); // Files to code in a batch
+    uint32_t count = 0;
+    if (!names) {
+        perror("encode");
+        exit(1);
+    }
 
     static struct option options[] = {
           { "input", required_argument, NULL, 'i' }, { "output", required_argument, NULL, 'o' },
           { "verbose", no_argument, &verbose, 'v' }, { "print", no_argument, &print, 'p' },
-          { "full", no_argument, &fullTree, 'f' }, { NULL, 0, NULL, 0 } };
+          { "full", no_argument, &fullTree, 'f' }, { "canonical", no_argument, &canonical, 'c' },
+          { "limit", required_argument, NULL, 'l' }, { "threads", required_argument, NULL, 't' },
+          { "block", required_argument, NULL, 'b' }, { "stream", no_argument, &stream, 's' },
+          { "multi", no_argument, NULL, 'm' }, { "adaptive", no_argument, &adaptiveMode, 'a' },
+          { "table", required_argument, NULL, 'x' }, { "tables", required_argument, NULL, 'd' },
+          { "contexts", required_argument, NULL, 'k' }, { "runs", no_argument, NULL, 'r' },
+          { "sort", no_argument, NULL, 'z' }, { "fast", no_argument, NULL, '1' },
+          { "best", no_argument, NULL, '9' }, { "window", required_argument, NULL, 'w' },
+          { "words", no_argument, NULL, 'W' }, { "batch", no_argument, NULL, 'B' },
+          { "archive", required_argument, NULL, 'A' }, { NULL, 0, NULL, 0 } };
 
     int c;
-    while ((c = getopt_long(argc, argv, "-fupvi:o:", options, NULL)) != -1) {
+    const char *letters = "-123456789acfmrsupvzBWi:o:l:t:b:x:d:k:w:A:";
+    while ((c = getopt_long(argc, argv, letters, options, NULL)) != -1) {
         switch (c) {
+        case 1:
+            names[count++] = optarg;
+            break;
         case 'i':
             inputFile = strdup(optarg);
             break;
@@ -230,12 +573,171 @@ int main(int argc, char **argv) {
         case 'f':
             fullTree = true;
             break;
+        case 'c':
+            canonical = true;
+            break;
+        case 'l':
+            if (!readNumber(optarg, 10, MAXLIMIT, &number) || number < MINLIMIT) {
+                fprintf(stderr, "%s: code length limit must be from %d to %d\n", argv[0], MINLIMIT,
+                        MAXLIMIT);
+                showUsage(argv[0]);
+            }
+            limit = number;
+            canonical = true; // Only the lengths describe a limited code
+            break;
+        case 't':
+            if (!readNumber(optarg, 10, MAXTHREADS, &number)) {
+                fprintf(stderr, "%s: threads must be from 0 (all cores) to %d\n", argv[0],
+                        MAXTHREADS);
+                showUsage(argv[0]);
+            }
+            threads = number;
+            blocks = true;
+            break;
+        case 'b':
+            blockSize = readKB(optarg, MAXBLOCK);
+            if (blockSize == 0) {
+                fprintf(stderr, "%s: block size must be from 1 to %d KB\n", argv[0], MAXBLOCK / KB);
+                exit(1);
+            }
+            blocks = true;
+            break;
+        case 'a':
+            adaptiveMode = true;
+            break;
+        case 'k':
+            if (!readNumber(optarg, 10, CLUSTERS, &number) || number < 1) {
+                fprintf(stderr, "%s: number of code tables must be from 1 to %d\n", argv[0],
+                        CLUSTERS);
+                showUsage(argv[0]);
+            }
+            clusters = number;
+            blocks = true; // Only blocks have room for the tables
+            break;
+        case 'r':
+            transforms |= RLE;
+            blocks = true;
+            break;
+        case 'z':
+            transforms |= BWT;
+            blocks = true;
+            break;
+        case 'W':
+            transforms |= WORDS;
+            blocks = true;
+            break;
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+        case '6':
+        case '7':
+        case '8':
+        case '9':
+            level = c - '0';
+            blocks = true; // Only blocks have room for the codes of matches
+            break;
+        case 'w':
+            window = readKB(optarg, MAXWINDOW);
+            if (window == 0) {
+                fprintf(stderr, "%s: window must be from 1 to %d KB\n", argv[0], MAXWINDOW / KB);
+                exit(1);
+            }
+            windowed = true;
+            break;
+        case 'm':
+            streams = STREAMS; // Only blocks have room for a jump table
+            blocks = true;
+            break;
+        case 'x':
+            if (!readNumber(optarg, 16, UINT16_MAX, &number)) {
+                fprintf(stderr, "%s: table ID must be from 0 to ffff (hex)\n", argv[0]);
+                showUsage(argv[0]);
+            }
+            tableNumber = number;
+            break;
+        case 'd':
+            tables = optarg;
+            break;
+        case 's':
+            stream = true;
+            blocks = true;
+            break;
         case 'u':
               usage = true;
               break;
+        case 'B':
+            batch = true;
+            break;
+        case 'A':
+            archive = optarg;
+            batch = true;
+            break;
+        case '?':
+            showUsage(argv[0]);
         }
     }
 
+    // The adaptive code has no tree, table or blocks, so nothing that shapes
+    // one of those goes with it.
+    if (adaptiveMode
+        && (blocks || stream || canonical || fullTree || print || windowed || tableNumber >= 0)) {
+        fprintf(stderr, "%s: -a takes no other options for the code\n", argv[0]);
+        showUsage(argv[0]);
+    }
+
+    // A batch names its own outputs, and writes files of blocks unless there
+    // is a saved table, whose codes are loaded only once for all of them. An
+    // archive carries that table itself, so it can be decoded without it.
+    if (batch) {
+        if (inputFile || outputFile || adaptiveMode || print) {
+            fprintf(stderr, "%s: a batch takes only names, and does no adaptive coding or "
+                            "printing\n", argv[0]);
+            exit(1);
+        }
+        uint8_t shared[2 + LENGTHSOF(BYTE)];
+        uint16_t sharedBytes = 0;
+        if (tableNumber >= 0) {
+            uint8_t lengths[BYTE];
+            if (!loadTable(tables, tableNumber, lengths)
+                || !canonicalCodes(lengths, BYTE, tableCode)) {
+                fprintf(stderr, "%s: cannot load table %04x from %s\n", argv[0], tableNumber,
+                        tableDirectory(tables));
+                exit(1);
+            }
+            for (uint32_t i = 0; i < BYTE; i += 1) {
+                tableWords[i] = toWord(tableCode[i]);
+                tableLongest = lengths[i] > tableLongest ? lengths[i] : tableLongest;
+            }
+            shared[0] = tableNumber & 0xFF;
+            shared[1] = tableNumber >> 8;
+            sharedBytes = 2 + dumpLengths(lengths, BYTE, shared + 2);
+        }
+        bool ok;
+        if (archive) {
+            int file = open(archive, O_CREAT | O_EXCL | O_RDWR | O_TRUNC, 0644);
+            if (file < 0) {
+                perror(archive);
+                exit(1);
+            }
+            ok = packBatch(argv[0], file, shared, sharedBytes, names, count, threads, encodeOne,
+                           verbose);
+            if (close(file) != 0) {
+                perror(archive);
+                ok = false;
+            }
+        } else {
+            ok = runBatch(argv[0], names, count, threads, ".huf", true, encodeOne, verbose);
+        }
+        if (usage) {
+            printUsage();
+        }
+        free(names);
+        exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    free(names);
+
     if (inputFile) {
         if ((fileIn = open(inputFile, O_RDONLY)) < 0) {
             char s[1024] = { 0 };
@@ -246,6 +748,11 @@ int main(int argc, char **argv) {
             exit(1);
         }
         free(inputFile);
+    } else if (isRegular(STDIN_FILENO)) {
+        fileIn = STDIN_FILENO; // Can be read twice as it is
+    } else if (blocks || adaptiveMode || tableNumber >= 0) {
+        fileIn = STDIN_FILENO; // Blocks (or symbols, or bytes) are coded as they arrive
+        stream = true;
     } else {
         uint8_t buffer[KB];
 
@@ -261,7 +768,10 @@ int main(int argc, char **argv) {
 
         long len;
         while ((len = read(STDIN_FILENO, buffer, KB)) > 0) {
-            write(tmpFile, buffer, len);
+            if (!writeFully(tmpFile, buffer, len)) {
+                perror("encode");
+                exit(1);
+            }
         }
         fileIn = tmpFile;
     }
@@ -287,26 +797,172 @@ int main(int argc, char **argv) {
         fileOut = STDOUT_FILENO;
     }
 
+    // The adaptive code needs no tree at all, and only one pass.
+    if (adaptiveMode) {
+        uint16_t mode = stream ? S_IFREG | 0644 : fileStat.st_mode;
+        uint64_t size = stream ? UNKNOWN : origSize;
+        Header h = {
+            .magic = isBig() ? swap32(ADAPTIVE) : ADAPTIVE,
+            .permissions = isBig() ? swap16(mode) : mode,
+            .tree_size = 0,
+            .file_size = isBig() ? swap64(size) : size,
+        };
+        writeFully(fileOut, &h, sizeof(Header));
+        if (!stream) {
+            lseek(fileIn, 0, SEEK_SET); // Start of the file
+        }
+
+        uint64_t codeC = encodeAdaptive(fileIn, fileOut, &origSize);
+
+        if (verbose) {
+            fprintf(stderr, "Original %" PRIu64 " bits: adaptive ", 8 * origSize);
+            fprintf(stderr, "encoding %" PRIu64 " bits", codeC);
+            if (origSize > 0) {
+                fprintf(stderr, " (%2.4lf%%)", 100 * (double) codeC / (8 * origSize));
+            }
+            fprintf(stderr, ".\n");
+        }
+        if (usage) {
+            printUsage();
+        }
+        close(fileIn);
+        close(fileOut);
+        exit(EXIT_SUCCESS);
+    }
+
+    // In block mode there is no tree for the whole file, each block carries
+    // the code lengths of its own code. The size of a stream is not known
+    // until it ends, and it is given the permissions of a new file.
+    if (blocks) {
+        uint16_t mode = stream ? S_IFREG | 0644 : fileStat.st_mode;
+        uint64_t size = stream ? UNKNOWN : origSize;
+        Header h = {
+            .magic = isBig() ? swap32(BLOCKS) : BLOCKS,
+            .permissions = isBig() ? swap16(mode) : mode,
+            .tree_size = 0,
+            .file_size = isBig() ? swap64(size) : size,
+        };
+        writeFully(fileOut, &h, sizeof(Header));
+
+        uint64_t codeC = encodeBlocks(fileIn, fileOut, &origSize);
+
+        if (verbose) {
+            fprintf(stderr, "Original %" PRIu64 " bits: ", 8 * origSize);
+            fprintf(stderr, "%" PRIu64 " blocks ", (origSize + blockSize - 1) / blockSize);
+            fprintf(stderr, "encoding %" PRIu64 " bits", codeC);
+            if (origSize > 0) {
+                fprintf(stderr, " (%2.4lf%%)", 100 * (double) codeC / (8 * origSize));
+            }
+            fprintf(stderr, ".\n");
+        }
+        if (usage) {
+            printUsage();
+        }
+        close(fileIn);
+        close(fileOut);
+        exit(EXIT_SUCCESS);
+    }
+
+    // Both passes read the input from its mapping, if it has one.
+    uint64_t mapSize = 0;
+    uint8_t *map = mapInput(fileIn, &mapSize);
+
+    // A saved table already has a code for every byte, so there is neither a
+    // histogram to take nor a tree to save, only the ID of the table.
+    if (tableNumber >= 0) {
+        uint8_t lengths[BYTE];
+        code builtCode[BYTE];
+        if (!loadTable(tables, tableNumber, lengths) || !canonicalCodes(lengths, BYTE, builtCode)) {
+            fprintf(stderr, "%s: cannot load table %04x from %s\n", argv[0], tableNumber,
+                    tableDirectory(tables));
+            exit(1);
+        }
+        uint16_t mode = stream ? S_IFREG | 0644 : fileStat.st_mode;
+        uint64_t size = stream ? UNKNOWN : origSize;
+        Header h = {
+            .magic = isBig() ? swap32(DICTIONARY) : DICTIONARY,
+            .permissions = isBig() ? swap16(mode) : mode,
+            .tree_size = isBig() ? swap16(tableNumber) : tableNumber,
+            .file_size = isBig() ? swap64(size) : size,
+        };
+        if (!writeFully(fileOut, &h, sizeof(Header))) {
+            perror("encode");
+            exit(1);
+        }
+
+        origSize = mapSize;
+        uint64_t codeC = encodeFile(fileIn, map, &origSize, fileOut, builtCode);
+        unmap(map, mapSize);
+
+        if (verbose) {
+            fprintf(stderr, "Original %" PRIu64 " bits: ", 8 * origSize);
+            fprintf(stderr, "table %04x ", tableNumber);
+            fprintf(stderr, "encoding %" PRIu64 " bit%s", codeC, codeC == 1 ? "" : "s");
+            if (origSize > 0) {
+                fprintf(stderr, " (%2.4lf%%)", 100 * (double) codeC / (8 * origSize));
+            }
+            fprintf(stderr, ".\n");
+        }
+        if (usage) {
+            printUsage();
+        }
+        close(fileIn);
+        close(fileOut);
+        exit(EXIT_SUCCESS);
+    }
+
+    // Build a Huffman tree
+    uint64_t hist[BYTE] = { 0 };
+    tree *t = buildTree(fileIn, map, mapSize, hist);
+    if (!t) {
+        perror("buildTree");
+        exit(1);
+    }
+
+    uint16_t leaves = 0;
+    for (uint32_t i = 0; i < BYTE; i += 1) {
+        if (fullTree || hist[i] > 0) {
+            leaves += 1;
+        }
+    }
+
+    // Walk the tree to find the codes for each symbol. A canonical code only
+    // needs the length of each code, so that is all that is saved.
+    code builtCode[BYTE];
+    uint8_t lengths[BYTE] = { 0 };
+    uint8_t savedTree[TREE > LENGTHS ? TREE : LENGTHS];
+    uint16_t treeBytes;
+    if (canonical) {
+        codeLengths(t, lengths);
+        if (limit && !limitLengths(hist, lengths, BYTE, limit)) {
+            perror("limitLengths");
+            exit(1);
+        }
+        canonicalCodes(lengths, BYTE, builtCode);
+        treeBytes = dumpLengths(lengths, BYTE, savedTree);
+    } else {
+        code s = newCode();
+        buildCode(s, t, builtCode);
+        treeBytes = dumpTree(t, BYTE, savedTree);
+    }
+
     // Build header, canonical is "Little Endian".
     Header h = {
-        .magic = isBig() ? swap32(magicNumber) : magicNumber,
+        .magic = isBig() ? swap32(canonical ? CANONICAL : MAGIC) : (canonical ? CANONICAL : MAGIC),
         .permissions = isBig() ? swap16(fileStat.st_mode) : fileStat.st_mode,
+        .tree_size = isBig() ? swap16(treeBytes) : treeBytes,
         .file_size = isBig() ? swap64(origSize) : origSize,
     };
 
-    // Build a Huffman tree, finish header and write it out.
-    treeNode *t = buildTree(fileIn, fileOut, &h);
-
-    // Walk the tree to find the codes for each symbol
-    code s = newCode();
-    code builtCode[BYTE];
-    buildCode(s, t, builtCode);
-
-    // Output the tree
-    dumpTree(fileOut, t);
-    buffered_write(fileOut, (uint8_t *) 0, 0, true);
+    // Output the header and the tree
+    if (!writeFully(fileOut, &h, sizeof(Header)) || !writeFully(fileOut, savedTree, treeBytes)) {
+        perror("encode");
+        exit(1);
+    }
 
-    encodeFile(fileIn, fileOut, builtCode); // Output the encoded file
+    // Output the encoded file
+    uint64_t codeC = encodeFile(fileIn, map, &mapSize, fileOut, builtCode);
+    unmap(map, mapSize);
 
     if (verbose) {
         fprintf(stderr, "Original %" PRIu64 " bits: ", 8 * origSize);
@@ -320,7 +976,7 @@ int main(int argc, char **argv) {
     }
 
     if (print) {
-        printTree(t, 0);
+        printTree(t);
     }
 
     if (usage) {
@@ -1,3 +1,6 @@
+#include "histogram.h"
+#include "sizes.h"
+
 #include <inttypes.h>
 #include <math.h>
 #include <stdio.h>
@@ -6,20 +9,15 @@
 #include <sys/uio.h>
 #include <unistd.h>
 
-#define BYTE  256
-#define KBYTE 1024
-
 static uint64_t number = 0, count[BYTE] = { 0 };
 
-static uint8_t buffer[KBYTE] = { 0 };
+static uint8_t buffer[64 * KB] = { 0 };
 
 void tally(int file) {
-    int length;
-    while ((length = read(file, buffer, KBYTE)) > 0) {
+    ssize_t length;
+    while ((length = read(file, buffer, sizeof(buffer))) > 0) {
         number += length;
-        for (int i = 0; i < length; i += 1) {
-            count[buffer[i]] += 1;
-        }
+        countBytes(buffer, length, count);
     }
     return;
 }
@@ -0,0 +1,522 @@
+#include "flow.h"
+
+#include "io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define URING
+#endif
+#endif
+
+// Write all n bytes, at offset if the flow has a place for them.
+
+static bool writeOut(flow *f, const uint8_t *b, size_t n, uint64_t offset) {
+    return f->place ? writeAt(f->file, b, n, offset) : writeFully(f->file, b, n);
+}
+
+#ifdef URING
+
+// The rings are shared with the kernel, which has no library here, only its
+// two system calls. We add requests at the tail of the submission queue and
+// take results from the head of the completion queue; the kernel does the
+// opposite. A request carries the number of its chunk.
+
+typedef struct ring {
+    int fd;
+    void *sq, *cq; // The queues, which may be one mapping
+    size_t sqSize, cqSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    uint32_t *sqTail, *sqMask, *sqArray;
+    uint32_t *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    uint32_t pending; // Submitted and not yet complete
+} ring;
+
+static void *mapRing(int fd, size_t size, off_t what) {
+    void *m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, what);
+    return m == MAP_FAILED ? NULL : m;
+}
+
+static void delRing(ring *r) {
+    if (r) {
+        if (r->sqes) {
+            munmap(r->sqes, r->sqesSize);
+        }
+        if (r->cq && r->cq != r->sq) {
+            munmap(r->cq, r->cqSize);
+        }
+        if (r->sq) {
+            munmap(r->sq, r->sqSize);
+        }
+        close(r->fd);
+        free(r);
+    }
+    return;
+}
+
+// A kernel that cannot do plain reads and writes (before 5.6), or that has
+// io_uring turned off, gives NULL.
+
+static ring *newRing(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, DEPTH, &p);
+    ring *r = fd >= 0 ? (ring *) calloc(1, sizeof(ring)) : NULL;
+    if (!r) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    r->fd = fd;
+    r->sqSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    r->cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        r->sqSize = r->cqSize = r->sqSize > r->cqSize ? r->sqSize : r->cqSize;
+    }
+    r->sq = mapRing(fd, r->sqSize, IORING_OFF_SQ_RING);
+    r->cq = single ? r->sq : mapRing(fd, r->cqSize, IORING_OFF_CQ_RING);
+    r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe *) mapRing(fd, r->sqesSize, IORING_OFF_SQES);
+    if (!(p.features & IORING_FEAT_RW_CUR_POS) || !r->sq || !r->cq || !r->sqes) {
+        delRing(r);
+        return NULL;
+    }
+    uint8_t *sq = (uint8_t *) r->sq, *cq = (uint8_t *) r->cq;
+    r->sqTail = (uint32_t *) (sq + p.sq_off.tail);
+    r->sqMask = (uint32_t *) (sq + p.sq_off.ring_mask);
+    r->sqArray = (uint32_t *) (sq + p.sq_off.array);
+    r->cqHead = (uint32_t *) (cq + p.cq_off.head);
+    r->cqTail = (uint32_t *) (cq + p.cq_off.tail);
+    r->cqMask = (uint32_t *) (cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return r;
+}
+
+static bool submitRing(ring *r, uint8_t op, int file, uint8_t *b, uint32_t n, uint64_t offset,
+                       uint64_t data) {
+    uint32_t tail = *r->sqTail, i = tail & *r->sqMask;
+    struct io_uring_sqe *e = &r->sqes[i];
+    memset(e, 0, sizeof(*e));
+    e->opcode = op;
+    e->fd = file;
+    e->addr = (uintptr_t) b;
+    e->len = n;
+    e->off = offset;
+    e->user_data = data;
+    r->sqArray[i] = i;
+    __atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+    long k;
+    while ((k = syscall(__NR_io_uring_enter, r->fd, 1, 0, 0, NULL, 0)) < 0 && errno == EINTR) {
+    }
+    if (k != 1) {
+        errno = k < 0 ? errno : EAGAIN;
+        return false;
+    }
+    r->pending += 1;
+    return true;
+}
+
+// Wait for the next result, returning false if waiting failed.
+
+static bool reapRing(ring *r, uint64_t *data, int32_t *result) {
+    uint32_t head = *r->cqHead;
+    while (head == __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE)) {
+        long entered = syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (entered < 0 && errno != EINTR) {
+            return false;
+        }
+    }
+    struct io_uring_cqe *c = &r->cqes[head & *r->cqMask];
+    *data = c->user_data;
+    *result = c->res;
+    __atomic_store_n(r->cqHead, head + 1, __ATOMIC_RELEASE);
+    r->pending -= 1;
+    return true;
+}
+
+// Read the rest of chunk c after the kernel cut a read short, so that only
+// the end of the file leaves it short. Returns false if a read fails.
+
+static bool readRest(flow *f, chunk *c) {
+    while (c->n > 0 && c->n < CHUNK) {
+        ssize_t k = pread(f->file, c->b + c->n, CHUNK - c->n, c->at + c->n);
+        if (k < 0 && errno == EINTR) {
+            continue;
+        } else if (k <= 0) {
+            return k == 0;
+        }
+        c->n += k;
+    }
+    return true;
+}
+
+// Take the next result for whichever chunk it is, returning false if waiting
+// for it failed. A read or write that the kernel cut short is finished here.
+
+static bool reapChunk(flow *f) {
+    uint64_t i;
+    int32_t result;
+    if (!reapRing(f->ring, &i, &result)) {
+        f->failed = true;
+        return false;
+    }
+    chunk *c = &f->chunks[i % DEPTH];
+    c->busy = false;
+    c->p = 0;
+    if (result < 0) {
+        f->failed = true;
+        errno = -result;
+        c->n = 0;
+    } else if (!f->out) {
+        c->n = result;
+        if (!readRest(f, c)) {
+            f->failed = true;
+        }
+    } else if ((size_t) result < c->n
+               && !writeOut(f, c->b + result, c->n - result, c->at + result)) {
+        f->failed = true;
+    }
+    return true;
+}
+
+// Wait for everything in flight, returning true if the kernel may still be
+// using the chunks. Reads that were never taken are dropped.
+
+static bool drainRing(flow *f) {
+    bool lost = false;
+    while (f->ring->pending > 0 && !lost) {
+        uint64_t i;
+        int32_t result;
+        lost = f->out ? !reapChunk(f) : !reapRing(f->ring, &i, &result);
+    }
+    delRing(f->ring);
+    return lost;
+}
+
+#endif
+
+// With a thread, the chunks go round in order. The thread reads into each
+// chunk as the caller hands it back, or writes out each chunk as the caller
+// hands it over, and the caller waits for a chunk only when it needs it.
+
+static void freeFlow(flow *f) {
+    for (uint32_t i = 0; i < DEPTH; i += 1) {
+        free(f->chunks[i].b);
+    }
+    pthread_cond_destroy(&f->changed);
+    pthread_mutex_destroy(&f->lock);
+    free(f);
+    return;
+}
+
+// A read that returns nothing ends the input. The caller may give up on the
+// input before then, and if the thread is still waiting on a read it is left
+// to free the flow itself.
+
+static void *readAhead(void *arg) {
+    flow *f = (flow *) arg;
+    pthread_mutex_lock(&f->lock);
+    while (!f->stop) {
+        chunk *c = &f->chunks[f->fill];
+        if (!c->busy) {
+            pthread_cond_wait(&f->changed, &f->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&f->lock);
+        ssize_t n;
+        do {
+            n = f->place ? pread(f->file, c->b, CHUNK, f->offset) : read(f->file, c->b, CHUNK);
+        } while (n < 0 && errno == EINTR);
+        int error = n < 0 ? errno : 0;
+        pthread_mutex_lock(&f->lock);
+        c->n = n > 0 ? n : 0;
+        f->offset += c->n;
+        f->error = error;
+        c->busy = false;
+        pthread_cond_broadcast(&f->changed);
+        if (n <= 0) {
+            break;
+        }
+        f->fill = (f->fill + 1) % DEPTH;
+    }
+    f->running = false;
+    bool orphan = f->stop;
+    pthread_mutex_unlock(&f->lock);
+    if (orphan) {
+        freeFlow(f);
+    }
+    return NULL;
+}
+
+// After a write fails the rest are dropped, so that the caller never waits.
+
+static void *writeBehind(void *arg) {
+    flow *f = (flow *) arg;
+    pthread_mutex_lock(&f->lock);
+    while (true) {
+        chunk *c = &f->chunks[f->fill];
+        if (!c->busy) {
+            if (f->stop) {
+                break;
+            }
+            pthread_cond_wait(&f->changed, &f->lock);
+            continue;
+        }
+        int error = f->error;
+        pthread_mutex_unlock(&f->lock);
+        if (!error && !writeOut(f, c->b, c->n, f->offset)) {
+            error = errno ? errno : EIO;
+        }
+        f->offset += c->n;
+        pthread_mutex_lock(&f->lock);
+        f->error = error;
+        c->p = 0;
+        c->busy = false;
+        pthread_cond_broadcast(&f->changed);
+        f->fill = (f->fill + 1) % DEPTH;
+    }
+    pthread_mutex_unlock(&f->lock);
+    return NULL;
+}
+
+// Wait until the caller has chunk c to itself, returning false if it never
+// will. An error from the thread counts once its output is lost, or once the
+// input has run out.
+
+static bool waitChunk(flow *f, chunk *c) {
+#ifdef URING
+    if (f->ring) {
+        while (c->busy) {
+            if (!reapChunk(f)) {
+                return false;
+            }
+        }
+        return true;
+    }
+#endif
+    pthread_mutex_lock(&f->lock);
+    while (c->busy) {
+        pthread_cond_wait(&f->changed, &f->lock);
+    }
+    if (f->error && (f->out || c->n == 0)) {
+        f->failed = true;
+        errno = f->error;
+    }
+    pthread_mutex_unlock(&f->lock);
+    return true;
+}
+
+// Hand chunk c over to be read into again, or to be written out.
+
+static void sendChunk(flow *f, chunk *c) {
+    if (f->out) {
+        c->n = c->p;
+    } else {
+        c->p = 0;
+    }
+#ifdef URING
+    if (f->ring) {
+        size_t n = f->out ? c->n : CHUNK;
+        c->at = f->offset;
+        uint8_t op = f->out ? IORING_OP_WRITE : IORING_OP_READ;
+        c->busy = submitRing(f->ring, op, f->file, c->b, n, f->offset, c - f->chunks);
+        f->offset += n;
+        if (!c->busy) {
+            f->failed = true;
+            c->n = 0;
+        }
+        return;
+    }
+#endif
+    pthread_mutex_lock(&f->lock);
+    c->busy = true;
+    pthread_cond_broadcast(&f->changed);
+    pthread_mutex_unlock(&f->lock);
+    return;
+}
+
+static flow *newFlow(int file, bool out) {
+    flow *f = (flow *) calloc(1, sizeof(flow));
+    if (!f) {
+        return NULL;
+    }
+    pthread_mutex_init(&f->lock, NULL);
+    pthread_cond_init(&f->changed, NULL);
+    f->file = file;
+    f->out = out;
+    for (uint32_t i = 0; i < DEPTH; i += 1) {
+        if (!(f->chunks[i].b = (uint8_t *) malloc(CHUNK))) {
+            freeFlow(f);
+            return NULL;
+        }
+    }
+
+    // Requests in flight at once can finish in any order, which is only
+    // safe at known offsets: not for a pipe, and not for a file opened to
+    // append, where every write goes on the end.
+
+    struct stat s;
+    off_t here = lseek(file, 0, SEEK_CUR);
+    int flags = fcntl(file, F_GETFL);
+    f->place = fstat(file, &s) == 0 && S_ISREG(s.st_mode) && here >= 0 && flags >= 0
+               && !(flags & O_APPEND);
+    f->start = f->offset = f->place ? (uint64_t) here : 0;
+
+#ifdef URING
+    const char *how = getenv(IO);
+    f->ring = f->place && !(how && strcmp(how, "thread") == 0) ? newRing() : NULL;
+    if (f->ring) {
+        for (uint32_t i = 0; !out && i < DEPTH; i += 1) {
+            sendChunk(f, &f->chunks[i]);
+        }
+        return f;
+    }
+#endif
+    for (uint32_t i = 0; i < DEPTH; i += 1) {
+        f->chunks[i].busy = !out; // Every chunk starts out to be read into
+    }
+    f->running = true;
+    if (pthread_create(&f->thread, NULL, out ? writeBehind : readAhead, f) != 0) {
+        freeFlow(f);
+        return NULL;
+    }
+    if (!out) {
+        pthread_detach(f->thread);
+    }
+    return f;
+}
+
+flow *newInflow(int file) {
+    return newFlow(file, false);
+}
+
+flow *newOutflow(int file) {
+    return newFlow(file, true);
+}
+
+size_t takeFlow(flow *f, void *b, size_t n) {
+    uint8_t *p = (uint8_t *) b;
+    size_t got = 0;
+    while (got < n && !f->ended) {
+        chunk *c = &f->chunks[f->next];
+        if (!waitChunk(f, c) || c->n == 0) {
+            f->ended = true;
+            break;
+        }
+        size_t k = n - got < c->n - c->p ? n - got : c->n - c->p;
+        memcpy(p + got, c->b + c->p, k);
+        c->p += k;
+        got += k;
+        if (c->p == c->n) {
+            f->ended = f->ring && c->n < CHUNK; // Only the end of a regular file is short
+            if (!f->ended) {
+                sendChunk(f, c);
+            }
+            f->next = (f->next + 1) % DEPTH;
+        }
+    }
+    f->moved += got;
+    return got;
+}
+
+bool putFlow(flow *f, const void *b, size_t n) {
+    const uint8_t *p = (const uint8_t *) b;
+    while (n > 0 && !f->failed) {
+        chunk *c = &f->chunks[f->next];
+        if (!waitChunk(f, c) || f->failed) {
+            break;
+        }
+        size_t k = n < CHUNK - c->p ? n : CHUNK - c->p;
+        memcpy(c->b + c->p, p, k);
+        c->p += k;
+        p += k;
+        n -= k;
+        f->moved += k;
+        if (c->p == CHUNK) {
+            sendChunk(f, c);
+            f->next = (f->next + 1) % DEPTH;
+        }
+    }
+    return !f->failed;
+}
+
+// The thread that reads ahead may be waiting on a read that never returns,
+// from a pipe, so it is not waited for. If it is still running it frees the
+// flow itself.
+
+static bool stopReading(flow *f) {
+    pthread_mutex_lock(&f->lock);
+    f->stop = true;
+    bool orphan = f->running;
+    pthread_cond_broadcast(&f->changed);
+    bool ok = !f->failed;
+    if (f->place) {
+        lseek(f->file, f->start + f->moved, SEEK_SET);
+    }
+    pthread_mutex_unlock(&f->lock);
+    if (!orphan) {
+        freeFlow(f);
+    }
+    return ok;
+}
+
+static void stopWriting(flow *f) {
+    pthread_mutex_lock(&f->lock);
+    f->stop = true;
+    pthread_cond_broadcast(&f->changed);
+    pthread_mutex_unlock(&f->lock);
+    pthread_join(f->thread, NULL);
+    if (f->error) {
+        f->failed = true;
+        errno = f->error;
+    }
+    return;
+}
+
+bool delFlow(flow *f) {
+    bool kernel = f->ring != NULL; // Not a thread
+    if (!kernel && !f->out) {
+        return stopReading(f);
+    }
+    if (f->out) { // The last chunk, if it has anything in it
+        chunk *c = &f->chunks[f->next];
+        if (waitChunk(f, c) && !f->failed && c->p > 0) {
+            sendChunk(f, c);
+        }
+    }
+    bool lost = false; // The kernel may still be using the chunks
+#ifdef URING
+    if (kernel) {
+        lost = drainRing(f);
+    }
+#endif
+    if (!kernel) {
+        stopWriting(f);
+    }
+    if (f->place) {
+        lseek(f->file, f->start + f->moved, SEEK_SET);
+    }
+    bool ok = !f->failed;
+    if (lost) {
+        free(f);
+    } else {
+        freeFlow(f);
+    }
+    return ok;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A flow moves the bytes of a file in order, in either direction, with
+// several large reads (or writes) in flight while the caller codes, so that
+// neither the disk nor the processor waits for the other. An inflow reads
+// ahead of what has been taken from it, and an outflow writes behind what
+// has been put into it, a chunk at a time.
+//
+// A regular file is read or written through an io_uring, at known offsets,
+// where the kernel has one. Anything else (a pipe, a file opened to append),
+// or a kernel without io_uring, gets a thread that does the reads or writes
+// instead. Setting HUFFMAN_IO=thread picks the thread anyway.
+
+#define CHUNK (1 << 20) // Bytes in each read or write
+#define DEPTH 4 // Chunks: the one in use, and the rest in flight
+
+#define IO "HUFFMAN_IO"
+
+typedef struct chunk {
+    uint8_t *b;
+    size_t n; // Bytes read into it, or put into it to be written
+    size_t p; // Bytes taken from it, or put into it, so far
+    uint64_t at; // Where it is being written
+    bool busy; // Being read or written
+} chunk;
+
+typedef struct flow {
+    int file;
+    bool out; // Writing
+    bool failed; // A read or write failed (errno has why)
+    bool ended; // Nothing more to read
+    chunk chunks[DEPTH];
+    uint32_t next; // The chunk in use
+    bool place; // Read or write at offset, not at the offset of the file
+    uint64_t start; // Where the flow started in the file
+    uint64_t moved; // Bytes taken or put
+    uint64_t offset; // Where the next read or write goes
+    struct ring *ring; // NULL with a thread
+    pthread_t thread;
+    pthread_mutex_t lock; // Over the chunks, with a thread
+    pthread_cond_t changed;
+    uint32_t fill; // The chunk the thread reads into or writes out next
+    bool stop, running;
+    int error; // Why the thread failed
+} flow;
+
+extern flow *newInflow(int file);
+
+extern flow *newOutflow(int file);
+
+// Take up to n bytes, fewer only at the end of the input or if a read failed.
+
+extern size_t takeFlow(flow *f, void *b, size_t n);
+
+// Put n bytes, returning false if a write has failed.
+
+extern bool putFlow(flow *f, const void *b, size_t n);
+
+// Finish the flow, waiting for any writes, and leave the offset of a file
+// that can seek just after the bytes taken or put. Returns false if a read
+// or write failed.
+
+extern bool delFlow(flow *f);
@@ -0,0 +1,123 @@
+#include "histogram.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Counting with a single table stalls whenever neighbouring bytes are the
+// same, since each increment has to wait for the previous store to the same
+// count. Spreading the bytes over four tables lets the increments overlap,
+// and a run of RUN identical bytes is counted with a single addition. The
+// tables hold 32-bit counts, so they are added into hist every SPAN bytes.
+
+#define TABLES 4
+#define RUN    32
+#define SPAN   (1 << 30)
+
+typedef uint32_t tables[TABLES][BYTE];
+
+static inline void countWord(uint64_t w, tables t) {
+    t[0][w & 0xFF] += 1;
+    t[1][w >> 8 & 0xFF] += 1;
+    t[2][w >> 16 & 0xFF] += 1;
+    t[3][w >> 24 & 0xFF] += 1;
+    t[0][w >> 32 & 0xFF] += 1;
+    t[1][w >> 40 & 0xFF] += 1;
+    t[2][w >> 48 & 0xFF] += 1;
+    t[3][w >> 56] += 1;
+    return;
+}
+
+// Count RUN bytes a word at a time, or all at once if they are all the same.
+// The order of the bytes in a word does not matter when counting them.
+
+static inline void countRun(const uint8_t *b, bool same, tables t) {
+    if (same) {
+        t[0][b[0]] += RUN;
+    } else {
+        for (uint32_t i = 0; i < RUN; i += 8) {
+            uint64_t w;
+            memcpy(&w, b + i, 8);
+            countWord(w, t);
+        }
+    }
+    return;
+}
+
+static inline bool samePlain(const uint8_t *b) {
+    uint64_t w[RUN / 8], all = b[0] * UINT64_C(0x0101010101010101), diff = 0;
+    memcpy(w, b, RUN);
+    for (uint32_t i = 0; i < RUN / 8; i += 1) {
+        diff |= w[i] ^ all;
+    }
+    return diff == 0;
+}
+
+static size_t countPlain(const uint8_t *b, size_t n, tables t) {
+    size_t i = 0;
+    for (; i + RUN <= n; i += RUN) {
+        countRun(b + i, samePlain(b + i), t);
+    }
+    return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static size_t countAVX2(const uint8_t *b, size_t n, tables t) {
+    size_t i = 0;
+    for (; i + RUN <= n; i += RUN) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (b + i));
+        __m256i all = _mm256_set1_epi8((char) b[i]);
+        countRun(b + i, _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, all)) == -1, t);
+    }
+    return i;
+}
+#elif defined(__ARM_NEON)
+static size_t countNEON(const uint8_t *b, size_t n, tables t) {
+    size_t i = 0;
+    for (; i + RUN <= n; i += RUN) {
+        uint8x16_t all = vdupq_n_u8(b[i]);
+        uint8x16_t lo = vceqq_u8(vld1q_u8(b + i), all), hi = vceqq_u8(vld1q_u8(b + i + 16), all);
+        uint8x16_t eq = vandq_u8(lo, hi);
+        uint64x2_t e = vreinterpretq_u64_u8(eq);
+        countRun(b + i, (vgetq_lane_u64(e, 0) & vgetq_lane_u64(e, 1)) == UINT64_MAX, t);
+    }
+    return i;
+}
+#endif
+
+// Pick the fastest kernel that this processor supports. Each returns how
+// many bytes it counted, a multiple of RUN; the rest are counted here.
+
+static void countSpan(const uint8_t *b, size_t n, tables t) {
+#if defined(__x86_64__) || defined(__i386__)
+    size_t i = __builtin_cpu_supports("avx2") ? countAVX2(b, n, t) : countPlain(b, n, t);
+#elif defined(__ARM_NEON)
+    size_t i = countNEON(b, n, t);
+#else
+    size_t i = countPlain(b, n, t);
+#endif
+    for (; i < n; i += 1) {
+        t[i % TABLES][b[i]] += 1;
+    }
+    return;
+}
+
+void countBytes(const uint8_t *b, size_t n, uint64_t hist[BYTE]) {
+    while (n > 0) {
+        tables t = { { 0 } };
+        size_t span = n < SPAN ? n : SPAN;
+        countSpan(b, span, t);
+        for (uint32_t i = 0; i < BYTE; i += 1) {
+            hist[i] += (uint64_t) t[0][i] + t[1][i] + t[2][i] + t[3][i];
+        }
+        b += span;
+        n -= span;
+    }
+    return;
+}
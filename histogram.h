@@ -0,0 +1,10 @@
+#pragma once
+
+#include "sizes.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Add the number of occurrences of each byte in b[0, n) to hist.
+
+extern void countBytes(const uint8_t *b, size_t n, uint64_t hist[BYTE]);
@@ -1,4 +1,5 @@
 #include "huffman.h"
+#include "queue.h"
 
 #include <ctype.h>
 #include <inttypes.h>
@@ -7,31 +8,191 @@
 #include <stdlib.h>
 #include <string.h>
 
-treeNode *newNode(uint8_t s, bool l, uint64_t c) {
-    treeNode *n = (treeNode *) malloc(sizeof(treeNode));
-    if (n) {
+tree *newTree(uint32_t size) {
+    tree *t = (tree *) malloc(sizeof(tree) + size * sizeof(treeNode));
+    if (t) {
+        t->size = size;
+        t->count = 0;
+        t->root = 0;
+        return t;
+    } else {
+        return NULL;
+    }
+}
+
+treeNode *newNode(tree *t, uint16_t s, bool l, uint64_t c) {
+    if (t && t->count < t->size) {
+        treeNode *n = &t->nodes[t->count];
         n->symbol = s;
         n->count = c;
         n->leaf = l;
-        n->left = NULL;
-        n->right = NULL;
+        n->left = 0;
+        n->right = 0;
+        t->root = t->count++;
         return n;
     } else {
         return NULL;
     }
 }
 
-treeNode *join(treeNode *l, treeNode *r) {
-    treeNode *n = newNode('$', false, l->count + r->count);
+treeNode *join(tree *t, treeNode *l, treeNode *r) {
+    treeNode *n = newNode(t, '$', false, l->count + r->count);
     if (n) {
-        n->left = l;
-        n->right = r;
+        n->left = l - t->nodes;
+        n->right = r - t->nodes;
         return n;
     } else {
         return NULL;
     }
 }
 
+static void codeFrom(code s, const tree *t, uint32_t i, code c[]) {
+    const treeNode *n = &t->nodes[i];
+    if (n->leaf) {
+        c[n->symbol] = s; // Found it
+        return;
+    } else {
+        uint32_t tmp;
+
+        pushCode(&s, 0); // Go left
+        codeFrom(s, t, n->left, c);
+        popCode(&s, &tmp);
+
+        pushCode(&s, 1); // Go right
+        codeFrom(s, t, n->right, c);
+        popCode(&s, &tmp);
+    }
+}
+
+void buildCode(code s, const tree *t, code c[]) {
+    if (t && t->count) {
+        codeFrom(s, t, t->root, c);
+    }
+    return;
+}
+
+// Save the tree in post-order, 'L' and the symbol for a leaf and 'I' for an
+// interior node, and return the number of bytes (at most TREEOF(symbols)):
+//   1. Two bytes for each leaf, or three if there are more symbols than
+//      bytes (the symbol is little endian)
+//   2. One byte for each internal node
+//   3. leaves - 1 internal nodes
+//   4. Zero is the minimum
+
+static uint32_t dumpFrom(const tree *t, uint32_t i, uint32_t symbols, uint8_t b[]) {
+    const treeNode *node = &t->nodes[i];
+    uint32_t n = 0;
+    if (node->leaf) {
+        b[n++] = 'L'; // Leaf indicator
+        b[n++] = node->symbol & 0xFF; // Symbol
+        if (symbols > BYTE) {
+            b[n++] = node->symbol >> 8;
+        }
+    } else {
+        n += dumpFrom(t, node->left, symbols, b + n);
+        n += dumpFrom(t, node->right, symbols, b + n);
+        b[n++] = 'I'; // Interior node indicator
+    }
+    return n;
+}
+
+uint32_t dumpTree(const tree *t, uint32_t symbols, uint8_t b[]) {
+    return t && t->count ? dumpFrom(t, t->root, symbols, b) : 0;
+}
+
+// Build the Huffman tree for the symbols [0, symbols) that occur in hist, or
+// for all of them if full is set.
+
+tree *huffmanTree(uint64_t hist[], uint32_t symbols, bool full) {
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < symbols; i += 1) {
+        unique += hist[i] > 0;
+    }
+
+    // The tree must have at least two symbols in order to be valid. We
+    // could special-case a zero symbol tree, but that is a waste of code
+    // for a single case.
+
+    if (unique < 2) // Less than two symbols? We need stand-ins.
+    {
+        hist[0x00] = hist[0x00] ? hist[0x00] : hist[0x00] + 1;
+        hist[symbols - 1] = hist[symbols - 1] ? hist[symbols - 1] : hist[symbols - 1] + 1;
+    }
+
+    // A tree of n leaves has 2n - 1 nodes, so one block for all of them is
+    // known in advance. The queue holds nodes where they are in the block,
+    // which never moves.
+
+    tree *t = newTree(2 * symbols - 1);
+    queue *q = newQueue(symbols + 1);
+    if (!t || !q) {
+        delTree(t);
+        delQueue(q);
+        return NULL;
+    }
+
+    // We provide the option to building a full tree or a minimal tree.
+
+    for (uint32_t i = 0; i < symbols; i += 1) {
+        if (full || hist[i] > 0) {
+            enqueue(q, newNode(t, i, true, hist[i]));
+        }
+    }
+
+    while (!empty(q)) {
+        treeNode *l, *r;
+
+        dequeue(q, &l); // Left child
+
+        if (!empty(q)) {
+            dequeue(q, &r); // Right child
+            enqueue(q, join(t, l, r)); // Interior node
+        } // Singleton is the root, the last node made
+    }
+    delQueue(q);
+    return t;
+}
+
+// flattenTree returns NULL if memory runs out or the tree has too many nodes
+// or symbols for an entry.
+
+uint16_t *flattenTree(const tree *t) {
+    if (!t || !t->count || t->count >= 2 * FLATLEAF) {
+        return NULL;
+    }
+    uint16_t *flat = (uint16_t *) malloc((t->count + 1) * sizeof(uint16_t));
+    uint32_t *order = (uint32_t *) malloc(t->count * sizeof(uint32_t));
+    bool ok = flat && order;
+
+    const treeNode *root = &t->nodes[t->root];
+    if (ok && root->leaf) {
+        flat[0] = flat[1] = FLATLEAF | root->symbol;
+        ok = root->symbol < FLATLEAF;
+    } else if (ok) {
+        order[0] = t->root;
+    }
+    for (uint32_t head = 0, tail = 1; ok && !root->leaf && head < tail; head += 1) {
+        const treeNode *n = &t->nodes[order[head]];
+        uint32_t child[2] = { n->left, n->right };
+        for (uint32_t b = 0; b < 2; b += 1) {
+            const treeNode *c = &t->nodes[child[b]];
+            if (c->leaf) {
+                flat[2 * head + b] = FLATLEAF | c->symbol;
+                ok = ok && c->symbol < FLATLEAF;
+            } else {
+                flat[2 * head + b] = tail;
+                order[tail++] = child[b];
+            }
+        }
+    }
+    free(order);
+    if (!ok) {
+        free(flat);
+        return NULL;
+    }
+    return flat;
+}
+
 static inline void spaces(int c) {
     for (int i = 0; i < c; i += 1) {
         fputc(' ', stderr);
@@ -39,29 +200,28 @@ static inline void spaces(int c) {
     return;
 }
 
-void printTree(treeNode *t, int depth) {
-    if (t) {
-        printTree(t->left, depth + 1);
-        spaces(4 * depth);
-        if (t->leaf) {
-            if (isgraph(t->symbol)) {
-                fprintf(stderr, "'%c' (%" PRIu64 ")\n", t->symbol, t->count);
-            } else {
-                fprintf(stderr, "0x%02X (%" PRIu64 ")\n", t->symbol, t->count);
-            }
+static void printFrom(const tree *t, uint32_t i, int depth) {
+    const treeNode *n = &t->nodes[i];
+    if (!n->leaf) {
+        printFrom(t, n->left, depth + 1);
+    }
+    spaces(4 * depth);
+    if (n->leaf) {
+        if (n->symbol < BYTE && isgraph(n->symbol)) {
+            fprintf(stderr, "'%c' (%" PRIu64 ")\n", n->symbol, n->count);
         } else {
-            fprintf(stderr, "$ (%" PRIu64 ")\n", t->count);
+            fprintf(stderr, "0x%02X (%" PRIu64 ")\n", (unsigned) n->symbol, n->count);
         }
-        printTree(t->right, depth + 1);
+    } else {
+        fprintf(stderr, "$ (%" PRIu64 ")\n", n->count);
+        printFrom(t, n->right, depth + 1);
     }
     return;
 }
 
-void freeTree(treeNode *t) {
-    if (t) {
-        freeTree(t->left);
-        freeTree(t->right);
-        free(t);
+void printTree(const tree *t) {
+    if (t && t->count) {
+        printFrom(t, t->root, 0);
     }
     return;
 }
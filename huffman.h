@@ -1,42 +1,74 @@
 #pragma once
 
+#include "code.h"
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
-#define MAGIC 0xBEEFD00D
+#define MAGIC      0xBEEFD00D // A post-order tree follows the header
+#define CANONICAL  0xBEEFC0DE // Canonical code lengths follow the header
+#define BLOCKS     0xBEEFB10C // Independently coded blocks follow the header
+#define ADAPTIVE   0xBEEFADA7 // Adaptive Huffman code bits follow the header
+#define DICTIONARY 0xBEEFD1C7 // Code bits of a saved table follow the header
+#define ARCHIVE    0xBEEFA4C1 // Many coded files follow the header (see archive.h)
+
+#define TREEOF(n) ((n) <= BYTE ? 3 * (n) - 1 : 4 * (n) - 1) // Bytes in the largest saved tree
+#define TREE      TREEOF(BYTE)
 
 typedef struct DAH treeNode;
 
 typedef treeNode *item;
 
+// The children of a node are where they are in the nodes of its tree, which
+// is a single block: a tree is allocated and freed all at once, and its
+// nodes are packed together instead of spread over the heap. A child always
+// comes before its parent, so the root of a finished tree is the last node.
+
 struct DAH {
-    uint8_t symbol;
     uint64_t count;
+    uint32_t left, right;
+    uint16_t symbol;
     bool leaf;
-    treeNode *left, *right;
 };
 
-extern treeNode *newNode(uint8_t s, bool l, uint64_t c);
+typedef struct tree {
+    uint32_t size; // Nodes it has room for
+    uint32_t count; // Nodes in use
+    uint32_t root;
+    treeNode nodes[];
+} tree;
 
-extern treeNode *join(treeNode *l, treeNode *r);
+extern tree *newTree(uint32_t size);
 
-static inline void delNode(treeNode *h) {
-    free(h);
+static inline void delTree(tree *t) {
+    free(t);
     return;
 }
 
-static inline void delTree(treeNode *h) {
-    if (h) {
-        delTree(h->left);
-        delTree(h->right);
-        delNode(h);
-    }
-    return;
-}
+extern treeNode *newNode(tree *t, uint16_t s, bool l, uint64_t c);
+
+extern treeNode *join(tree *t, treeNode *l, treeNode *r);
+
+extern tree *huffmanTree(uint64_t hist[], uint32_t symbols, bool full);
 
 static inline int compare(treeNode *l, treeNode *r) {
-    return (int) (l->count - r->count);
+    return (l->count > r->count) - (l->count < r->count);
 }
 
-extern void printTree(treeNode *t, int depth);
+// A tree for decoding alone keeps only where each bit leads: two 16-bit
+// entries for each interior node, in breadth-first order with the root
+// first, so that the top of the tree, where every symbol starts, shares a
+// few cache lines. An entry is the interior node it leads to, or FLATLEAF
+// and the symbol of a leaf. A tree of a single leaf becomes a root whose
+// entries are both that leaf.
+
+#define FLATLEAF 0x8000
+
+extern uint16_t *flattenTree(const tree *t);
+
+extern void printTree(const tree *t);
+
+extern void buildCode(code s, const tree *t, code c[]);
+
+extern uint32_t dumpTree(const tree *t, uint32_t symbols, uint8_t b[]);
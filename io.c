@@ -0,0 +1,53 @@
+#include "io.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Move all n bytes, at offset if place is set. A read that finds the end of
+// the input before n bytes fails with errno set to EIO, as does a write that
+// writes nothing.
+
+static size_t move(int file, uint8_t *b, size_t n, bool out, bool place, uint64_t offset) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t count;
+        if (out) {
+            count = place ? pwrite(file, b + done, n - done, offset + done)
+                          : write(file, b + done, n - done);
+        } else {
+            count = place ? pread(file, b + done, n - done, offset + done)
+                          : read(file, b + done, n - done);
+        }
+        if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count <= 0) {
+            errno = count == 0 ? EIO : errno;
+            break;
+        }
+        done += count;
+    }
+    return done;
+}
+
+bool readFully(int file, void *b, size_t n) {
+    return move(file, (uint8_t *) b, n, false, false, 0) == n;
+}
+
+bool writeFully(int file, const void *b, size_t n) {
+    return move(file, (uint8_t *) b, n, true, false, 0) == n;
+}
+
+bool readAt(int file, void *b, size_t n, uint64_t offset) {
+    return move(file, (uint8_t *) b, n, false, true, offset) == n;
+}
+
+bool writeAt(int file, const void *b, size_t n, uint64_t offset) {
+    return move(file, (uint8_t *) b, n, true, true, offset) == n;
+}
+
+size_t readUpTo(int file, void *b, size_t n) {
+    return move(file, (uint8_t *) b, n, false, false, 0);
+}
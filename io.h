@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A read or write may move fewer bytes than it was asked to (from a pipe, or
+// when a signal arrives), so these keep going until all n bytes have moved.
+// They return false if a read or write fails, with errno saying why, or if
+// the input ends first.
+
+extern bool readFully(int file, void *b, size_t n);
+
+extern bool writeFully(int file, const void *b, size_t n);
+
+// The same at offset, leaving the offset of the file alone.
+
+extern bool readAt(int file, void *b, size_t n, uint64_t offset);
+
+extern bool writeAt(int file, const void *b, size_t n, uint64_t offset);
+
+// Read up to n bytes, fewer only at the end of the input or if a read fails.
+
+extern size_t readUpTo(int file, void *b, size_t n);
@@ -0,0 +1,141 @@
+#include "lz77.h"
+
+#include "endian.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASHBITS 16
+#define TOOFAR   4096 // Matches of MINMATCH bytes further back cost more than the bytes
+
+// How hard each level tries, as in zlib: once a match is good long only a
+// quarter of the chain is searched, a match of lazy or more is taken without
+// trying the next byte (no lazy matching at all if zero), a match of nice or
+// more ends the search, and at most chain links are followed.
+
+typedef struct effort {
+    uint32_t good, lazy, nice, chain;
+} effort;
+
+static const effort levels[LEVELS + 1] = {
+    { 0, 0, 0, 0 }, // Not used
+    { 4, 0, 8, 4 },
+    { 4, 0, 16, 8 },
+    { 4, 0, 32, 32 },
+    { 4, 4, 16, 16 },
+    { 8, 16, 32, 32 },
+    { 8, 16, 128, 128 },
+    { 8, 32, 128, 256 },
+    { 32, 128, MAXMATCH, 1024 },
+    { 32, MAXMATCH, MAXMATCH, 4096 },
+};
+
+static inline uint32_t hash(const uint8_t *p) {
+    uint32_t x = p[0] | p[1] << 8 | p[2] << 16;
+    return (x * UINT32_C(2654435761)) >> (32 - HASHBITS);
+}
+
+// How many of the first most bytes at a and b agree, a word at a time.
+
+static inline uint32_t agree(const uint8_t *a, const uint8_t *b, uint32_t most) {
+    uint32_t k = 0;
+    for (; k + 8 <= most; k += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + k, 8);
+        memcpy(&y, b + k, 8);
+        if (x != y) {
+            uint64_t d = isBig() ? swap64(x ^ y) : x ^ y;
+            return k + __builtin_ctzll(d) / 8;
+        }
+    }
+    while (k < most && a[k] == b[k]) {
+        k += 1;
+    }
+    return k;
+}
+
+// The longest match for position i that is longer than best, following the
+// chain from the position before it, or zero if there is none.
+
+static uint32_t longest(const uint8_t *in, uint32_t n, uint32_t i, const uint32_t *prev,
+                        uint32_t window, const effort *e, uint32_t best, uint32_t *distance) {
+    uint32_t most = n - i < MAXMATCH ? n - i : MAXMATCH, found = 0;
+    uint32_t chain = best >= e->good ? e->chain / 4 : e->chain;
+    uint32_t nice = e->nice < most ? e->nice : most;
+    for (uint32_t j = prev[i]; j > 0 && i - (j - 1) <= window && chain > 0;
+         j = prev[j - 1], chain -= 1) {
+        const uint8_t *c = in + j - 1;
+        if (best < most && c[best] != in[i + best]) {
+            continue; // Cannot be longer
+        }
+        uint32_t k = agree(in + i, c, most);
+        if (k > best) {
+            best = found = k;
+            *distance = i - (j - 1);
+            if (k >= nice) {
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+// Add the positions from filed up to last to the chains, returning the next
+// position to file. Positions are kept as one more than themselves, so that
+// zero ends a chain.
+
+static uint32_t enter(const uint8_t *in, uint32_t n, uint32_t filed, uint32_t last, uint32_t *head,
+                     uint32_t *prev) {
+    for (; filed <= last && filed + MINMATCH <= n; filed += 1) {
+        uint32_t h = hash(in + filed);
+        prev[filed] = head[h];
+        head[h] = filed + 1;
+    }
+    return filed;
+}
+
+uint32_t findMatches(const uint8_t *in, uint32_t n, uint32_t level, uint32_t window, match *m) {
+    level = level < 1 ? 1 : (level > LEVELS ? LEVELS : level);
+    window = window < 1 ? 1 : (window > MAXWINDOW ? MAXWINDOW : window);
+    const effort *e = &levels[level];
+    uint32_t *head = (uint32_t *) calloc(1 << HASHBITS, sizeof(uint32_t));
+    uint32_t *prev = (uint32_t *) malloc((n ? n : 1) * sizeof(uint32_t));
+    bool ok = head && prev;
+
+    uint32_t count = 0, filed = 0;
+    for (uint32_t i = 0; i < n;) {
+        uint32_t length = 0, distance = 0;
+        if (ok && i + MINMATCH <= n) {
+            filed = enter(in, n, filed, i, head, prev);
+            length = longest(in, n, i, prev, window, e, MINMATCH - 1, &distance);
+            length = length == MINMATCH && distance > TOOFAR ? 0 : length;
+        }
+
+        // Lazy matching: a longer match at the next byte is worth a literal.
+
+        while (length && length < e->lazy && i + 1 + MINMATCH <= n) {
+            filed = enter(in, n, filed, i + 1, head, prev);
+            uint32_t further = 0, next = longest(in, n, i + 1, prev, window, e, length, &further);
+            if (!next) {
+                break;
+            }
+            m[count++] = (match) { .distance = 0, .length = in[i] };
+            i += 1;
+            length = next;
+            distance = further;
+        }
+
+        if (length) {
+            m[count++] = (match) { .distance = distance, .length = length };
+            i += length;
+        } else {
+            m[count++] = (match) { .distance = 0, .length = in[i] };
+            i += 1;
+        }
+    }
+    free(head);
+    free(prev);
+    return count;
+}
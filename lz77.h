@@ -0,0 +1,57 @@
+#pragma once
+
+#include "sizes.h"
+
+#include <stdint.h>
+
+// LZ77, as in Deflate: a byte string that occurred earlier in the block is
+// replaced by its length and its distance back to the earlier copy. The
+// earlier copies are found through hash chains: every position is filed
+// under a hash of its first MINMATCH bytes, and each position links to the
+// last one before it with the same hash. A level says how far down a chain
+// to look and how hard to try for a better match at the next byte.
+
+#define MINMATCH  3
+#define MAXMATCH  258
+#define WINDOW    (KB * KB) // Default distance we look back for matches, a default block
+#define MAXWINDOW (16 * KB * KB)
+#define LEVELS    9
+
+// The lengths and distances are coded as a slot, with a Huffman code, and
+// extra bits that say where in the slot they are. The slots of v >= 4 are
+// two for each power of two, told apart by the bit below the top one; the
+// extra bits are the rest. There are 16 slots of match length and 48 of
+// distance. Literals and lengths share one alphabet, the lengths after the
+// bytes.
+
+#define LITERALS  (BYTE + 16) // Symbols of the literal and length code
+#define DISTANCES 48 // Symbols of the distance code
+
+static inline uint32_t slotOf(uint32_t v) {
+    if (v < 4) {
+        return v;
+    }
+    uint32_t k = 31 - __builtin_clz(v);
+    return 2 * k + ((v >> (k - 1)) & 0x1);
+}
+
+static inline uint32_t slotBits(uint32_t slot) {
+    return slot < 4 ? 0 : slot / 2 - 1;
+}
+
+static inline uint32_t slotBase(uint32_t slot) {
+    return slot < 4 ? slot : (2 + (slot & 0x1)) << (slot / 2 - 1);
+}
+
+// A literal has distance zero and the byte as its length.
+
+typedef struct match {
+    uint32_t distance;
+    uint32_t length;
+} match;
+
+// Find the matches of the n bytes at in and write the literals and matches
+// that make them to m (at most n of them), returning how many there are.
+
+extern uint32_t findMatches(const uint8_t *in, uint32_t n, uint32_t level, uint32_t window,
+                            match *m);
@@ -0,0 +1,56 @@
+#include "map.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Map all of a regular file for reading, and say how big it is.
+
+uint8_t *mapInput(int file, uint64_t *size) {
+    struct stat s;
+    if (fstat(file, &s) != 0 || !S_ISREG(s.st_mode) || s.st_size <= 0
+        || (uint64_t) s.st_size > SIZE_MAX) {
+        return NULL;
+    }
+    void *map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    (void) madvise(map, s.st_size, MADV_SEQUENTIAL);
+    *size = s.st_size;
+    return (uint8_t *) map;
+}
+
+// Make a regular file exactly size bytes long, with the space on disk for
+// all of it, and map all of it for writing. Storing into a page that the file
+// system has no room for would raise SIGBUS, so if the space cannot be had
+// (or the file cannot be mapped) the file is put back the way it was.
+
+uint8_t *mapOutput(int file, uint64_t size) {
+    struct stat s;
+    if (fstat(file, &s) != 0 || !S_ISREG(s.st_mode) || size == 0 || size > SIZE_MAX
+        || size > INT64_MAX || ftruncate(file, size) != 0) {
+        return NULL;
+    }
+    if (posix_fallocate(file, 0, size) != 0) {
+        (void) ftruncate(file, s.st_size);
+        return NULL;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (map == MAP_FAILED) {
+        (void) ftruncate(file, s.st_size);
+        return NULL;
+    }
+    (void) madvise(map, size, MADV_SEQUENTIAL);
+    return (uint8_t *) map;
+}
+
+void unmap(uint8_t *map, uint64_t size) {
+    if (map) {
+        munmap(map, size);
+    }
+    return;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Large regular files are mapped into memory rather than read and written a
+// few KB at a time. A file that cannot be mapped (a pipe, a terminal, an
+// empty file, a file opened write-only, an output there is no room for)
+// gives NULL, and the caller falls back to read() and write().
+
+extern uint8_t *mapInput(int file, uint64_t *size);
+
+extern uint8_t *mapOutput(int file, uint64_t size);
+
+extern void unmap(uint8_t *map, uint64_t size);
@@ -0,0 +1,116 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+// The number of processors that are online, and at least one.
+
+uint32_t cores(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint32_t) n : 1;
+}
+
+// Each worker takes the oldest job, runs it without holding the lock, and
+// then marks it done. Workers leave once the pool is stopped and there is
+// nothing left to do.
+
+static void *worker(void *arg) {
+    pool *p = (pool *) arg;
+
+    pthread_mutex_lock(&p->lock);
+    while (true) {
+        while (!p->head && !p->stop) {
+            pthread_cond_wait(&p->work, &p->lock);
+        }
+        if (!p->head) {
+            break; // Stopped
+        }
+        job *j = p->head;
+        p->head = j->next;
+        p->tail = p->head ? p->tail : NULL;
+
+        pthread_mutex_unlock(&p->lock);
+        j->run(j);
+        pthread_mutex_lock(&p->lock);
+
+        j->done = true;
+        pthread_cond_broadcast(&p->finished);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// Encapsulate and localize dynamic allocations. If not every thread can be
+// started, we make do with the ones that were.
+
+pool *newPool(uint32_t threads) {
+    pool *p = (pool *) calloc(1, sizeof(pool));
+    if (p) {
+        p->workers = (pthread_t *) calloc(threads, sizeof(pthread_t));
+        if (p->workers) {
+            pthread_mutex_init(&p->lock, NULL);
+            pthread_cond_init(&p->work, NULL);
+            pthread_cond_init(&p->finished, NULL);
+            for (uint32_t i = 0; i < threads; i += 1) {
+                if (pthread_create(&p->workers[i], NULL, worker, p) != 0) {
+                    break;
+                }
+                p->threads += 1;
+            }
+            if (p->threads > 0) {
+                return p;
+            }
+            delPool(p);
+            return NULL;
+        }
+    }
+    free(p);
+    return NULL;
+}
+
+// Let the workers finish whatever has been submitted, then clean up.
+
+void delPool(pool *p) {
+    if (p) {
+        pthread_mutex_lock(&p->lock);
+        p->stop = true;
+        pthread_cond_broadcast(&p->work);
+        pthread_mutex_unlock(&p->lock);
+
+        for (uint32_t i = 0; i < p->threads; i += 1) {
+            pthread_join(p->workers[i], NULL);
+        }
+        pthread_cond_destroy(&p->finished);
+        pthread_cond_destroy(&p->work);
+        pthread_mutex_destroy(&p->lock);
+        free(p->workers);
+        free(p);
+    }
+    return;
+}
+
+void submit(pool *p, job *j) {
+    pthread_mutex_lock(&p->lock);
+    j->done = false;
+    j->next = NULL;
+    if (p->tail) {
+        p->tail->next = j;
+    } else {
+        p->head = j;
+    }
+    p->tail = j;
+    pthread_cond_signal(&p->work);
+    pthread_mutex_unlock(&p->lock);
+    return;
+}
+
+// Wait for a job to be done.
+
+void await(pool *p, job *j) {
+    pthread_mutex_lock(&p->lock);
+    while (!j->done) {
+        pthread_cond_wait(&p->finished, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return;
+}
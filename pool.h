@@ -0,0 +1,37 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// A pool of worker threads that run jobs in the order they are submitted.
+// A job is embedded at the start of a larger structure that carries its
+// arguments and results; run is called with the job itself.
+
+#define MAXTHREADS 4096 // Most threads we are willing to start
+
+typedef struct job {
+    void (*run)(struct job *);
+    bool done;
+    struct job *next;
+} job;
+
+typedef struct pool {
+    uint32_t threads;
+    pthread_t *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t work; // Signalled when a job is submitted
+    pthread_cond_t finished; // Signalled when a job is done
+    job *head, *tail; // Jobs that have not started
+    bool stop;
+} pool;
+
+extern uint32_t cores(void);
+
+extern pool *newPool(uint32_t threads);
+
+extern void delPool(pool *p);
+
+extern void submit(pool *p, job *j);
+
+extern void await(pool *p, job *j);
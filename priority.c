@@ -3,15 +3,11 @@
 
 #include <stdlib.h>
 
-static inline uint32_t succ(uint32_t x, uint32_t n) {
-    return (x + n + 1) % n;
-}
-
-// Number theory says modulo should be positive, but in C we have -1 % n = -1,
-// and we want n - 1.
+// Whether a should come out of the queue before b.
 
-static inline uint32_t pred(uint32_t x, uint32_t n) {
-    return (x + n - 1) % n;
+static inline bool before(const slot *a, const slot *b) {
+    int c = compare(a->i, b->i);
+    return c < 0 || (c == 0 && a->order < b->order);
 }
 
 // Encapsulate and localize dynamic allocations. This way you can check them,
@@ -21,9 +17,9 @@ queue *newQueue(uint32_t size) {
     queue *q = (queue *) malloc(sizeof(queue));
     if (q) {
         q->size = size;
-        q->head = 0;
-        q->tail = 0;
-        q->Q = (item *) calloc(size, sizeof(item));
+        q->count = 0;
+        q->next = 0;
+        q->Q = (slot *) calloc(size, sizeof(slot));
         if (q->Q) {
             return q;
         }
@@ -43,45 +39,41 @@ void delQueue(queue *q) {
     return;
 }
 
-// Both head and tail point to an empty slot.
-
 bool empty(queue *q) {
     if (q) {
-        return q->head == q->tail;
+        return q->count == 0;
     } else {
         return true; // NULL queues are empty
     }
 }
 
-// full sacrifices one slot to make the computation easier.
+// full keeps one slot spare, as the queue always has.
 
 bool full(queue *q) {
     if (q) {
-        return succ(q->head, q->size) == q->tail;
+        return q->count + 1 >= q->size;
     } else {
         return true; // NULL queues are full
     }
 }
 
-// enqueue places the smallest element at the tail using the equivalent of an
-// insertion sort. This is preferable to a more sophisticated method when you
-// understand that there are never more than 257 entries (including the empty
-// slot) in the queue and the average case will be less than 500 operations,
-// with the worst case being 32896 operations.
+// enqueue adds the item at the bottom of the heap and moves it up past every
+// parent that should come out after it, and dequeue takes the top and moves
+// the last item down from there, so each takes O(log n) steps. An insertion
+// sort was fine for 257 entries, but not for an alphabet of 65536.
 
 bool enqueue(queue *q, item i) {
     if (full(q)) {
         return false;
     } else {
         if (q && q->Q) {
-            uint32_t slot = q->head;
-
-            while (slot != q->tail && compare(q->Q[pred(slot, q->size)], i) > 0) {
-                q->Q[slot] = q->Q[pred(slot, q->size)];
-                slot = pred(slot, q->size);
+            slot s = { .i = i, .order = q->next++ };
+            uint32_t k = q->count++;
+            while (k > 0 && before(&s, &q->Q[(k - 1) / 2])) {
+                q->Q[k] = q->Q[(k - 1) / 2];
+                k = (k - 1) / 2;
             }
-            q->Q[slot] = i;
-            q->head = succ(q->head, q->size);
+            q->Q[k] = s;
         }
         return true;
     }
@@ -92,8 +84,20 @@ bool dequeue(queue *q, item *i) {
         return false;
     } else {
         if (q && q->Q) {
-            *i = q->Q[q->tail];
-            q->tail = succ(q->tail, q->size);
+            *i = q->Q[0].i;
+            slot last = q->Q[--q->count];
+            uint32_t k = 0;
+            for (uint32_t child = 1; child < q->count; child = 2 * k + 1) {
+                if (child + 1 < q->count && before(&q->Q[child + 1], &q->Q[child])) {
+                    child += 1;
+                }
+                if (!before(&q->Q[child], &last)) {
+                    break;
+                }
+                q->Q[k] = q->Q[child];
+                k = child;
+            }
+            q->Q[k] = last;
         }
         return true;
     }
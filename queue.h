@@ -5,10 +5,19 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+// A priority queue of up to size - 1 items, smallest first, kept as a binary
+// heap. Items that compare equal come out in the order they went in.
+
+typedef struct slot {
+    item i;
+    uint64_t order; // When it was enqueued, to break ties
+} slot;
+
 typedef struct queue {
     uint32_t size;
-    uint32_t head, tail;
-    item *Q;
+    uint32_t count; // Items in Q[0, count)
+    uint64_t next; // Order of the next item
+    slot *Q;
 } queue;
 
 extern queue *newQueue(uint32_t size);
@@ -0,0 +1,78 @@
+#include "runs.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Where the run of b that reaches i ends, a word at a time, since the runs
+// worth coding are long.
+
+static uint32_t runEnd(const uint8_t *in, uint32_t i, uint32_t n, uint8_t b) {
+    uint64_t all = UINT64_C(0x0101010101010101) * b;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, in + i, 8);
+        if (word != all) {
+            break;
+        }
+    }
+    while (i < n && in[i] == b) {
+        i += 1;
+    }
+    return i;
+}
+
+uint32_t packRuns(const uint8_t *in, uint32_t n, uint8_t *out) {
+    uint32_t i = 0, p = 0;
+    while (i < n) {
+        uint8_t b = in[i];
+        uint32_t j = i + 1;
+        while (j < n && j - i < RUN && in[j] == b) {
+            j += 1;
+        }
+        memcpy(out + p, in + i, j - i);
+        p += j - i;
+        if (j - i == RUN) {
+            uint32_t end = runEnd(in, j, n, b), more = end - j;
+            do {
+                out[p++] = (more & 0x7F) | (more > 0x7F ? 0x80 : 0);
+                more >>= 7;
+            } while (more > 0);
+            j = end;
+        }
+        i = j;
+    }
+    return p;
+}
+
+bool unpackRuns(const uint8_t *in, uint32_t m, uint8_t *out, uint32_t raw) {
+    uint32_t i = 0, o = 0, same = 0;
+    while (i < m) {
+        uint8_t b = in[i++];
+        if (o == raw) {
+            return false;
+        }
+        same = same && out[o - 1] == b ? same + 1 : 1;
+        out[o++] = b;
+        if (same == RUN) { // A count follows
+            uint64_t more = 0;
+            uint8_t c;
+            uint32_t shift = 0;
+            do {
+                if (i == m || shift > 28) {
+                    return false;
+                }
+                c = in[i++];
+                more |= (uint64_t) (c & 0x7F) << shift;
+                shift += 7;
+            } while (c & 0x80);
+            if (more > raw - o) {
+                return false;
+            }
+            memset(out + o, b, more);
+            o += more;
+            same = 0;
+        }
+    }
+    return o == raw;
+}
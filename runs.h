@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Run-length coding, ahead of the Huffman code, in the byte alphabet: once
+// RUN equal bytes in a row have been written, the next byte (or bytes) count
+// how many more of them there were, from zero up, seven bits at a time with
+// the low bits first and the top bit of a byte set if more follow. A run of a
+// million zeros becomes four zeros and three bytes of count, where even the
+// best Huffman code would spend a bit on each zero.
+
+#define RUN 4
+
+#define RUNSBOUND(n) ((n) + (n) / RUN + 5) // Most bytes that packRuns makes of n
+
+// Run-length code n bytes into out, returning how many bytes it took.
+
+extern uint32_t packRuns(const uint8_t *in, uint32_t n, uint8_t *out);
+
+// Undo packRuns, returning false unless the m bytes at in make exactly raw
+// bytes.
+
+extern bool unpackRuns(const uint8_t *in, uint32_t m, uint8_t *out, uint32_t raw);
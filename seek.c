@@ -0,0 +1,152 @@
+#include "seek.h"
+
+#include "endian.h"
+#include "header.h"
+#include "huffman.h"
+#include "io.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Without an index, find the blocks by following the Block headers.
+
+static Index *scanBlocks(int file, uint64_t *blocks) {
+    uint64_t n = 0, size = 0, offset = sizeof(Header), position = 0;
+    Index *index = NULL;
+
+    Block k;
+    while (readAt(file, &k, sizeof(Block), offset)) {
+        uint32_t raw = isBig() ? swap32(k.raw) : k.raw;
+        uint32_t packed = isBig() ? swap32(k.packed) : k.packed;
+        if (raw == 0) {
+            *blocks = n;
+            return index;
+        }
+        if (n == size) {
+            size = size ? 2 * size : 64;
+            Index *t = (Index *) realloc(index, size * sizeof(Index));
+            if (!t) {
+                break;
+            }
+            index = t;
+        }
+        index[n] = (Index) { .offset = offset, .position = position };
+        n += 1;
+        offset += sizeof(Block) + packed;
+        position += raw;
+    }
+    free(index);
+    return NULL; // Ran off the end of the file
+}
+
+// A stream does not say how big it was, but its last Block does. Returns
+// UNKNOWN if that Block cannot be read.
+
+static uint64_t streamSize(int file, Index *index, uint64_t blocks) {
+    Block k;
+    uint64_t offset = blocks ? index[blocks - 1].offset : sizeof(Header);
+    if (!readAt(file, &k, sizeof(Block), offset)) {
+        return UNKNOWN;
+    }
+    return (blocks ? index[blocks - 1].position : 0) + (isBig() ? swap32(k.raw) : k.raw);
+}
+
+blockFile *openBlocks(int file) {
+    Header h;
+    if (!readAt(file, &h, sizeof(Header), 0)
+        || (isBig() ? swap32(h.magic) : h.magic) != BLOCKS) {
+        return NULL;
+    }
+
+    blockFile *f = (blockFile *) calloc(1, sizeof(blockFile));
+    if (f) {
+        f->file = file;
+        f->size = isBig() ? swap64(h.file_size) : h.file_size;
+        f->index = readIndex(file, &f->blocks);
+        if (!f->index) {
+            f->index = scanBlocks(file, &f->blocks);
+        }
+        if (f->size == UNKNOWN) {
+            f->size = streamSize(file, f->index, f->blocks);
+        }
+        if ((f->index || f->size == 0) && f->size != UNKNOWN) {
+            f->cached = f->blocks;
+            return f;
+        }
+    }
+    free(f);
+    return NULL;
+}
+
+void closeBlocks(blockFile *f) {
+    if (f) {
+        free(f->index);
+        free(f->in);
+        free(f->out);
+        free(f);
+    }
+    return;
+}
+
+// Decode block i into out, unless it is already there.
+
+static bool loadBlock(blockFile *f, uint64_t i) {
+    if (f->cached == i) {
+        return true;
+    }
+    f->cached = f->blocks;
+
+    Block k;
+    if (!readAt(f->file, &k, sizeof(Block), f->index[i].offset)) {
+        return false;
+    }
+    uint32_t raw = isBig() ? swap32(k.raw) : k.raw;
+    uint32_t packed = isBig() ? swap32(k.packed) : k.packed;
+    if (raw == 0 || raw > MAXBLOCK || packed > BLOCKBOUND(MAXBLOCK)
+        || !grow(&f->in, &f->inSize, packed) || !grow(&f->out, &f->outSize, raw)
+        || !readAt(f->file, f->in, packed, f->index[i].offset + sizeof(Block))
+        || !decodeBlock(f->in, packed, f->out, raw)) {
+        return false;
+    }
+    f->cached = i;
+    f->raw = raw;
+    return true;
+}
+
+// Copy the decoded bytes [offset, offset + length) into out, and return how
+// many there were (fewer if the file ends first), or -1 if it is corrupt.
+
+int64_t readBlocks(blockFile *f, uint64_t offset, uint64_t length, uint8_t *out) {
+    if (offset >= f->size) {
+        return 0;
+    }
+    length = length < f->size - offset ? length : f->size - offset;
+
+    // The last block that starts at or before offset.
+
+    uint64_t lo = 0, hi = f->blocks;
+    while (hi - lo > 1) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (f->index[mid].position <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    uint64_t done = 0;
+    for (uint64_t i = lo; done < length && i < f->blocks; i += 1) {
+        if (!loadBlock(f, i) || offset + done < f->index[i].position) {
+            return -1;
+        }
+        uint64_t from = offset + done - f->index[i].position;
+        if (from >= f->raw) {
+            return -1;
+        }
+        uint64_t n = f->raw - from < length - done ? f->raw - from : length - done;
+        memcpy(out + done, f->out + from, n);
+        done += n;
+    }
+    return done == length ? (int64_t) done : -1;
+}
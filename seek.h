@@ -0,0 +1,30 @@
+#pragma once
+
+#include "block.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Random access to a file of blocks: readBlocks decodes only the blocks that
+// hold the bytes asked for. The index at the end of the file says where each
+// block is (if there is no index, the Block headers are read instead, which
+// still skips over the coded bytes). The last block decoded is kept, so that
+// a run of small reads does not decode the same block over and over.
+
+typedef struct blockFile {
+    int file;
+    uint64_t size; // Bytes in the decoded file
+    uint64_t blocks;
+    Index *index;
+    uint8_t *in, *out;
+    uint32_t inSize, outSize;
+    uint64_t cached; // The block that is in out, or blocks if none
+    uint32_t raw; // Bytes in the cached block
+} blockFile;
+
+extern blockFile *openBlocks(int file);
+
+extern void closeBlocks(blockFile *f);
+
+extern int64_t readBlocks(blockFile *f, uint64_t offset, uint64_t length, uint8_t *out);
@@ -3,4 +3,5 @@
 #define CODE 256
 #define KB   1024
 #define BYTE 256
+#define WORD 65536 // Largest alphabet, 16-bit symbols
 #define BLK  4096
@@ -0,0 +1,336 @@
+#include "stream.h"
+
+#include "block.h"
+#include "canon.h"
+#include "endian.h"
+#include "header.h"
+#include "huffman.h"
+#include "sizes.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Where an encoder or decoder is in the file of blocks.
+
+#define HEADER 0 // Header still to come
+#define BLOCK  1 // Between blocks
+#define BODY   2 // Inside a block, after its Block
+#define TAIL   3 // After the end of the blocks
+#define DONE   4 // Everything has been produced
+#define BROKEN 5 // The input made no sense (decoder)
+
+struct encoder {
+    uint32_t blockSize, limit, streams;
+    int state;
+    uint8_t *in; // The block being gathered
+    uint32_t have; // Bytes of it so far
+    uint8_t *out; // Output waiting for room
+    size_t pending, sent; // Bytes in out, and how many have been handed over
+    uint64_t position, offset; // Bytes coded, and bytes of output
+    Index *index;
+    uint64_t blocks, indexSize, indexed; // indexed entries have been output
+};
+
+struct decoder {
+    int state;
+    uint8_t *in; // A Header, Block or block being gathered
+    uint32_t inSize, have;
+    uint8_t *out; // A decoded block waiting for room
+    uint32_t outSize;
+    size_t pending, sent;
+    uint32_t raw, packed; // Sizes of the current block
+    uint64_t size, total, blocks; // Size from the Header, bytes produced, blocks seen
+    uint64_t skip; // Bytes of index still to come
+};
+
+static inline size_t least(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+static inline void consume(stream *s, size_t n) {
+    s->nextIn += n;
+    s->availIn -= n;
+    s->totalIn += n;
+    return;
+}
+
+static inline void produce(stream *s, size_t n) {
+    s->nextOut += n;
+    s->availOut -= n;
+    s->totalOut += n;
+    return;
+}
+
+// Hand over as much pending output as there is room for, returning true if
+// all of it is gone.
+
+static bool drain(stream *s, const uint8_t *b, size_t *pending, size_t *sent) {
+    size_t n = least(*pending - *sent, s->availOut);
+    if (n > 0) {
+        memcpy(s->nextOut, b + *sent, n);
+        produce(s, n);
+        *sent += n;
+    }
+    if (*sent < *pending) {
+        return false;
+    }
+    *pending = *sent = 0;
+    return true;
+}
+
+// Encapsulate and localize dynamic allocations. There is always room in out
+// for the largest coded block and for a whole KB of index.
+
+encoder *newEncoder(uint32_t blockSize, uint32_t limit, uint32_t streams) {
+    blockSize = blockSize ? blockSize : KB * KB;
+    if (blockSize < KB || blockSize > MAXBLOCK || (limit && (limit < MINLIMIT || limit > MAXLIMIT))
+        || (streams != 1 && streams != STREAMS)) {
+        return NULL;
+    }
+    encoder *e = (encoder *) calloc(1, sizeof(encoder));
+    if (e) {
+        e->blockSize = blockSize;
+        e->limit = limit;
+        e->streams = streams;
+        e->state = HEADER;
+        e->in = (uint8_t *) malloc(blockSize);
+        e->out = (uint8_t *) malloc(sizeof(Block) + BLOCKBOUND(blockSize));
+        e->indexSize = 64;
+        e->index = (Index *) malloc(e->indexSize * sizeof(Index));
+        if (e->in && e->out && e->index) {
+            return e;
+        }
+    }
+    delEncoder(e);
+    return NULL;
+}
+
+void delEncoder(encoder *e) {
+    if (e) {
+        free(e->in);
+        free(e->out);
+        free(e->index);
+        free(e);
+    }
+    return;
+}
+
+// Queue bytes of output, which always fit since out is empty when it is used.
+
+static void put(encoder *e, const void *b, size_t n) {
+    memcpy(e->out + e->pending, b, n);
+    e->pending += n;
+    e->offset += n;
+    return;
+}
+
+// Code a block and queue it behind its Block, noting where it went.
+
+static bool codeBlock(encoder *e, const uint8_t *b, uint32_t n) {
+    if (e->blocks == e->indexSize) {
+        Index *t = (Index *) realloc(e->index, 2 * e->indexSize * sizeof(Index));
+        if (!t) {
+            return false;
+        }
+        e->index = t;
+        e->indexSize *= 2;
+    }
+    e->index[e->blocks] = (Index) { .offset = e->offset, .position = e->position };
+    e->blocks += 1;
+
+    uint32_t packed = encodeBlock(b, n, e->out + sizeof(Block), e->limit, e->streams, 1, 0, 0, 0);
+    Block k = {
+        .raw = isBig() ? swap32(n) : n,
+        .packed = isBig() ? swap32(packed) : packed,
+    };
+    put(e, &k, sizeof(Block));
+    e->pending += packed;
+    e->offset += packed;
+    e->position += n;
+    return true;
+}
+
+int huffCompress(encoder *e, stream *s, bool finish) {
+    uint64_t totalIn = s->totalIn, totalOut = s->totalOut;
+
+    while (drain(s, e->out, &e->pending, &e->sent)) {
+        if (e->state == DONE) {
+            return HUFF_END;
+        } else if (e->state == HEADER) {
+            uint16_t mode = S_IFREG | 0644; // As for a stream coded by encode
+            Header h = {
+                .magic = isBig() ? swap32(BLOCKS) : BLOCKS,
+                .permissions = isBig() ? swap16(mode) : mode,
+                .tree_size = 0,
+                .file_size = UNKNOWN,
+            };
+            put(e, &h, sizeof(Header));
+            e->state = BLOCK;
+        } else if (e->state == TAIL) { // A KB of index at a time, then the Trailer
+            uint64_t n = least(e->blocks - e->indexed, KB / sizeof(Index));
+            packIndex(e->index + e->indexed, n, e->out);
+            e->pending = n * sizeof(Index);
+            e->indexed += n;
+            if (e->indexed == e->blocks) {
+                Trailer t = packTrailer(e->blocks);
+                put(e, &t, sizeof(Trailer));
+                e->state = DONE;
+            }
+        } else if (e->have == 0 && s->availIn >= e->blockSize) { // Straight from the caller
+            if (!codeBlock(e, s->nextIn, e->blockSize)) {
+                return HUFF_MEMORY;
+            }
+            consume(s, e->blockSize);
+        } else {
+            uint32_t n = least(s->availIn, e->blockSize - e->have);
+            if (n > 0) {
+                memcpy(e->in + e->have, s->nextIn, n);
+                consume(s, n);
+                e->have += n;
+            }
+            if (e->have == e->blockSize || (finish && e->have > 0 && s->availIn == 0)) {
+                if (!codeBlock(e, e->in, e->have)) {
+                    return HUFF_MEMORY;
+                }
+                e->have = 0;
+            } else if (finish && s->availIn == 0) { // The end of the blocks
+                Block end = { 0, 0 };
+                put(e, &end, sizeof(Block));
+                e->state = TAIL;
+            } else {
+                break; // Waiting for more input
+            }
+        }
+    }
+    return s->totalIn > totalIn || s->totalOut > totalOut ? HUFF_OK : HUFF_BUFFER;
+}
+
+decoder *newDecoder(void) {
+    decoder *d = (decoder *) calloc(1, sizeof(decoder));
+    if (d) {
+        d->state = HEADER;
+        if (grow(&d->in, &d->inSize, KB)) {
+            return d;
+        }
+    }
+    delDecoder(d);
+    return NULL;
+}
+
+void delDecoder(decoder *d) {
+    if (d) {
+        free(d->in);
+        free(d->out);
+        free(d);
+    }
+    return;
+}
+
+// Gather n bytes in in, returning true once they are all there.
+
+static bool gather(decoder *d, stream *s, uint32_t n) {
+    uint32_t take = least(n - d->have, s->availIn);
+    if (take > 0) {
+        memcpy(d->in + d->have, s->nextIn, take);
+        consume(s, take);
+        d->have += take;
+    }
+    return d->have == n;
+}
+
+// Decode the current block, straight from the caller's input and into the
+// caller's output when they hold all of it.
+
+static int decodeBody(decoder *d, stream *s) {
+    const uint8_t *in = d->in;
+    if (d->have == 0 && s->availIn >= d->packed) {
+        in = s->nextIn;
+        consume(s, d->packed);
+    } else if (!gather(d, s, d->packed)) {
+        return HUFF_OK;
+    }
+
+    bool direct = s->availOut >= d->raw;
+    if (!direct && !grow(&d->out, &d->outSize, d->raw)) {
+        return HUFF_MEMORY;
+    }
+    if (!decodeBlock(in, d->packed, direct ? s->nextOut : d->out, d->raw)) {
+        return HUFF_DATA;
+    }
+    if (direct) {
+        produce(s, d->raw);
+    } else {
+        d->pending = d->raw;
+    }
+    d->have = 0;
+    d->total += d->raw;
+    d->blocks += 1;
+    d->state = BLOCK;
+    return HUFF_OK;
+}
+
+int huffDecompress(decoder *d, stream *s) {
+    uint64_t totalIn = s->totalIn, totalOut = s->totalOut;
+
+    while (d->state != BROKEN && drain(s, d->out, &d->pending, &d->sent)) {
+        if (d->state == DONE) {
+            return HUFF_END;
+        } else if (d->state == TAIL) { // Skip over the index, then check its Trailer
+            uint64_t n = least(d->skip, s->availIn);
+            consume(s, n);
+            d->skip -= n;
+            if (d->skip > 0 || !gather(d, s, sizeof(Trailer))) {
+                break; // Waiting for the rest of the index
+            }
+            Trailer t;
+            memcpy(&t, d->in, sizeof(Trailer));
+            d->have = 0;
+            bool index = (isBig() ? swap32(t.magic) : t.magic) == INDEX;
+            bool count = (isBig() ? swap64(t.blocks) : t.blocks) == d->blocks;
+            d->state = index && count ? DONE : BROKEN;
+        } else if (d->state == BODY) {
+            int result = decodeBody(d, s);
+            if (result != HUFF_OK) {
+                d->state = result == HUFF_DATA ? BROKEN : d->state;
+                return result;
+            }
+            if (d->state == BODY) {
+                break; // Waiting for the rest of the block
+            }
+        } else if (!gather(d, s, d->state == HEADER ? sizeof(Header) : sizeof(Block))) {
+            break; // Waiting for the rest of a Header or Block
+        } else if (d->state == HEADER) {
+            Header h;
+            memcpy(&h, d->in, sizeof(Header));
+            d->have = 0;
+            d->size = isBig() ? swap64(h.file_size) : h.file_size;
+            d->state = (isBig() ? swap32(h.magic) : h.magic) == BLOCKS ? BLOCK : BROKEN;
+        } else {
+            Block k;
+            memcpy(&k, d->in, sizeof(Block));
+            d->have = 0;
+            d->raw = isBig() ? swap32(k.raw) : k.raw;
+            d->packed = isBig() ? swap32(k.packed) : k.packed;
+            if (d->raw == 0) { // The end, and the index follows
+                bool whole = d->size == UNKNOWN || d->total == d->size;
+                d->skip = d->blocks * sizeof(Index);
+                d->state = whole ? TAIL : BROKEN;
+            } else if (d->raw > MAXBLOCK || d->packed > BLOCKBOUND(MAXBLOCK)
+                       || (d->size != UNKNOWN && d->raw > d->size - d->total)) {
+                d->state = BROKEN;
+            } else if (!grow(&d->in, &d->inSize, d->packed)) {
+                d->state = BROKEN;
+                return HUFF_MEMORY;
+            } else {
+                d->state = BODY;
+            }
+        }
+    }
+    if (d->state == BROKEN) {
+        return HUFF_DATA;
+    }
+    return s->totalIn > totalIn || s->totalOut > totalOut ? HUFF_OK : HUFF_BUFFER;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// In the style of zlib: the caller points a stream at the bytes it has and at
+// the room it has for output, and calls huffCompress or huffDecompress as
+// often as it takes. Each call consumes what input it can, produces what
+// output fits, and updates the stream to say how far it got.
+//
+// All state lives in the encoder or decoder, so any number of them can be in
+// use at once, on as many threads as there are contexts. What is produced and
+// consumed is the block format of encode -b (see block.h), which can be
+// written without knowing the size of the input in advance: the Header
+// file_size is UNKNOWN, and the blocks are followed by their index.
+
+typedef struct stream {
+    const uint8_t *nextIn; // Next input byte
+    size_t availIn; // Bytes available at nextIn
+    uint64_t totalIn; // Bytes consumed so far
+
+    uint8_t *nextOut; // Where the next output byte goes
+    size_t availOut; // Room left at nextOut
+    uint64_t totalOut; // Bytes produced so far
+} stream;
+
+#define HUFF_OK     0 // Progress was made; call again with more input or room
+#define HUFF_END    1 // All of the output has been produced
+#define HUFF_DATA   (-1) // The input is not a file of blocks, or is corrupt
+#define HUFF_MEMORY (-2) // Out of memory
+#define HUFF_BUFFER (-3) // No progress was possible with the input and room given
+
+typedef struct encoder encoder;
+
+typedef struct decoder decoder;
+
+// Blocks of blockSize bytes (at most MAXBLOCK, 0 for the default of 1 MB),
+// with no code longer than limit bits (0 for no limit, or from MINLIMIT to
+// MAXLIMIT in canon.h), in 1 or STREAMS
+// streams (see block.h).
+
+extern encoder *newEncoder(uint32_t blockSize, uint32_t limit, uint32_t streams);
+
+extern void delEncoder(encoder *e);
+
+// Compress as much as possible. Once all of the input has been handed over,
+// keep calling with finish set until HUFF_END.
+
+extern int huffCompress(encoder *e, stream *s, bool finish);
+
+extern decoder *newDecoder(void);
+
+extern void delDecoder(decoder *d);
+
+// Decompress as much as possible, returning HUFF_END once the last block has
+// been produced and the index after it has been read. The index is skipped,
+// but its Trailer must say INDEX and count the blocks that were decoded, or
+// the result is HUFF_DATA. Bytes after the Trailer are left unread.
+
+extern int huffDecompress(decoder *d, stream *s);
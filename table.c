@@ -0,0 +1,84 @@
+#include "table.h"
+
+#include <stdlib.h>
+
+// Subtables are handed out as they are needed, and the whole table doubles
+// when it runs out of room. There can never be more subtables than there
+// are interior nodes in the tree.
+
+static bool newSubtable(table *t, uint16_t *k) {
+    if (t->subtables == t->size) {
+        uint32_t size = t->size ? 2 * t->size : 4;
+        entry *e = (entry *) realloc(t->e, ((1 << LOOKUP) + (size << SUBBITS)) * sizeof(entry));
+        if (!e) {
+            return false;
+        }
+        for (uint32_t i = (1 << LOOKUP) + (t->size << SUBBITS);
+             i < (1 << LOOKUP) + (size << SUBBITS); i += 1) {
+            e[i] = (entry) { 0 };
+        }
+        t->e = e;
+        t->size = size;
+    }
+    *k = t->subtables;
+    t->subtables += 1;
+    return true;
+}
+
+// Insert a code into the table: a code that ends within the current table
+// fills every entry whose index begins with its remaining bits, a longer one
+// follows (or creates) the link to the next subtable.
+
+static bool insert(table *t, code *c, uint16_t symbol) {
+    uint32_t base = 0, width = LOOKUP, used = 0;
+
+    while (c->l - used > width) {
+        uint32_t i = base + (uint32_t) codeBits(c, used, width);
+        if (!t->e[i].link) {
+            uint16_t k;
+            if (!newSubtable(t, &k)) {
+                return false;
+            }
+            t->e[i] = (entry) { .value = k, .length = width, .link = 1 };
+        }
+        base = (1 << LOOKUP) + (t->e[i].value << SUBBITS);
+        used += width;
+        width = SUBBITS;
+    }
+
+    uint32_t length = c->l - used;
+    uint32_t prefix = (uint32_t) codeBits(c, used, length);
+    for (uint32_t k = 0; k < (1u << (width - length)); k += 1) {
+        t->e[base + (prefix | (k << length))] = (entry) { .value = symbol, .length = length };
+    }
+    return true;
+}
+
+// Build the table for the codes c[0 .. symbols - 1]; symbols without a code
+// have length zero.
+
+table *newTable(code c[], uint32_t symbols) {
+    table *t = (table *) calloc(1, sizeof(table));
+    if (t) {
+        t->e = (entry *) calloc(1 << LOOKUP, sizeof(entry));
+        if (t->e) {
+            for (uint32_t s = 0; s < symbols; s += 1) {
+                if (c[s].l > 0 && !insert(t, &c[s], s)) {
+                    delTable(t);
+                    return NULL;
+                }
+            }
+            return t;
+        }
+    }
+    free(t);
+    return NULL;
+}
+
+void delTable(table *t) {
+    if (t) {
+        free(t->e);
+        free(t);
+    }
+    return;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "bits.h"
+#include "code.h"
+
+#include <stdint.h>
+
+// A decoding table resolves a whole symbol from the next LOOKUP bits of the
+// input instead of walking the tree one bit at a time. Codes that are longer
+// than LOOKUP bits continue in subtables of SUBBITS bits each, so an entry is
+// either a symbol and the number of bits of its code that it consumed, or a
+// link to the subtable that resolves the rest of the code.
+
+#define LOOKUP  11
+#define SUBBITS 8
+
+typedef struct entry {
+    uint16_t value; // Symbol, or the subtable number if link is set
+    uint8_t length; // Number of bits consumed by this entry
+    uint8_t link; // Set if value names a subtable
+} entry;
+
+typedef struct table {
+    uint32_t subtables; // Number of subtables in use
+    uint32_t size; // Number of subtables allocated
+    entry *e; // Primary table followed by the subtables
+} table;
+
+extern table *newTable(code c[], uint32_t symbols);
+
+extern void delTable(table *t);
+
+static inline uint16_t decodeSymbol(table *t, bitReader *r) {
+    entry e = t->e[peekBits(r, LOOKUP)];
+    while (e.link) {
+        skipBits(r, e.length);
+        e = t->e[(1 << LOOKUP) + (e.value << SUBBITS) + peekBits(r, SUBBITS)];
+    }
+    skipBits(r, e.length);
+    return e.value;
+}
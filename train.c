@@ -0,0 +1,145 @@
+#include "canon.h"
+#include "dictionary.h"
+#include "histogram.h"
+#include "huffman.h"
+#include "map.h"
+#include "sizes.h"
+#include "table.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// train builds one canonical code from the bytes of all of the sample files
+// named on its command line and saves it as a table (see dictionary.h) for
+// encode -x and decode to share. Every byte gets a code, even one that never
+// appears in the samples, since the files coded with the table will not be
+// exactly like them. Codes are limited to LOOKUP bits unless asked otherwise,
+// so that the decoder resolves every symbol with a single lookup.
+
+static void tally(int file, uint64_t hist[]) {
+    uint64_t size = 0;
+    uint8_t *map = mapInput(file, &size);
+    if (map) {
+        countBytes(map, size, hist);
+        unmap(map, size);
+        return;
+    }
+
+    uint8_t b[64 * KB];
+    ssize_t count;
+    while ((count = read(file, b, sizeof(b))) > 0) {
+        countBytes(b, count, hist);
+    }
+    return;
+}
+
+int main(int argc, char **argv) {
+    char *dir = NULL;
+    uint32_t limit = LOOKUP;
+    int32_t id = -1;
+    bool verbose = false;
+    char *end; // Just past the number given with an option
+    unsigned long n;
+
+    static struct option options[] = { { "tables", required_argument, NULL, 'd' },
+        { "id", required_argument, NULL, 'n' }, { "limit", required_argument, NULL, 'l' },
+        { "verbose", no_argument, NULL, 'v' }, { NULL, 0, NULL, 0 } };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "vd:n:l:", options, NULL)) != -1) {
+        switch (c) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'n':
+            errno = 0;
+            n = strtoul(optarg, &end, 16);
+            if (!isxdigit((unsigned char) *optarg) || *end != '\0' || errno != 0
+                || n > UINT16_MAX) {
+                fprintf(stderr, "%s: table ID must be from 0 to ffff (hex)\n", argv[0]);
+                exit(1);
+            }
+            id = n;
+            break;
+        case 'l':
+            errno = 0;
+            n = strtoul(optarg, &end, 10);
+            if (!isdigit((unsigned char) *optarg) || *end != '\0' || errno != 0 || n > MAXLIMIT
+                || (n > 0 && n < MINLIMIT)) {
+                fprintf(stderr, "%s: code length limit must be 0 (none) or from %d to %d\n",
+                        argv[0], MINLIMIT, MAXLIMIT);
+                exit(1);
+            }
+            limit = n;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-v] [-d tables] [-n id] [-l limit] sample...\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (optind == argc) {
+        fprintf(stderr, "%s: no sample files\n", argv[0]);
+        exit(1);
+    }
+
+    uint64_t hist[BYTE] = { 0 };
+    for (int i = optind; i < argc; i += 1) {
+        int file = open(argv[i], O_RDONLY);
+        if (file < 0) {
+            char s[KB] = { 0 };
+            strncat(s, argv[0], sizeof(s) - strlen(s) - 1);
+            strncat(s, ": ", sizeof(s) - strlen(s) - 1);
+            strncat(s, argv[i], sizeof(s) - strlen(s) - 1);
+            perror(s);
+            exit(1);
+        }
+        tally(file, hist);
+        close(file);
+    }
+
+    uint64_t total = 0;
+    for (uint32_t s = 0; s < BYTE; s += 1) {
+        total += hist[s];
+        hist[s] += 1; // Room for bytes the samples lack
+    }
+
+    uint8_t lengths[BYTE];
+    if (!huffmanLengths(hist, BYTE, lengths)
+        || (limit && !limitLengths(hist, lengths, BYTE, limit))) {
+        perror("code lengths");
+        exit(1);
+    }
+
+    uint16_t name = id < 0 ? tableId(lengths) : (uint16_t) id;
+    if (!saveTable(dir, name, lengths)) {
+        fprintf(stderr, "%s: cannot save table %04x in %s (a different table has that ID?)\n",
+                argv[0], name, tableDirectory(dir));
+        exit(1);
+    }
+
+    if (verbose) {
+        uint64_t bits = 0;
+        for (uint32_t s = 0; s < BYTE; s += 1) {
+            bits += (hist[s] - 1) * lengths[s];
+        }
+        fprintf(stderr, "Samples %" PRIu64 " bits: ", 8 * total);
+        fprintf(stderr, "encoding %" PRIu64 " bits", bits);
+        if (total > 0) {
+            fprintf(stderr, " (%2.4lf%%)", 100 * (double) bits / (8 * total));
+        }
+        fprintf(stderr, ".\n");
+    }
+    printf("%04x\n", name);
+    return EXIT_SUCCESS;
+}